@@ -0,0 +1,143 @@
+// $Id$
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+using namespace std;
+
+#include <sys/mman.h>
+
+#include "cixbuffer.h"
+
+string to_string (const io_pool_stats& stats) {
+   ostringstream text;
+   text << "pool_slabs " << stats.slabs << "\n"
+        << "pool_hugepage_slabs " << stats.hugepage_slabs << "\n"
+        << "pool_buffers " << stats.buffers << "\n"
+        << "pool_buffer_size " << io_buffer_pool::BUFFER_SIZE << "\n"
+        << "pool_in_use " << stats.in_use << "\n"
+        << "pool_peak_in_use " << stats.peak_in_use << "\n"
+        << "pool_free " << stats.free << "\n"
+        << "pool_thread_cached " << stats.thread_cached << "\n"
+        << "pool_acquires " << stats.acquires << "\n";
+   return text.str();
+}
+
+// Free buffers owned by one thread.  Given back to the shared
+// free list when the thread exits.
+struct io_thread_cache {
+   vector<char*> buffers;
+   ~io_thread_cache() {
+      io_buffer_pool& pool = io_buffer_pool::instance();
+      lock_guard<mutex> guard (pool.lock);
+      pool.free_list.insert (pool.free_list.end(), buffers.begin(),
+                             buffers.end());
+   }
+};
+
+static thread_local io_thread_cache thread_cache;
+
+// Never destroyed, so that thread caches can always give back.
+io_buffer_pool& io_buffer_pool::instance() {
+   static io_buffer_pool* pool = new io_buffer_pool();
+   return *pool;
+}
+
+io_buffer_pool::io_buffer_pool() {
+   char* hugepages = getenv ("CIX_HUGEPAGES");
+   use_hugepages = hugepages != nullptr and atoi (hugepages) != 0;
+}
+
+void io_buffer_pool::grow() {
+   void* slab = MAP_FAILED;
+   if (use_hugepages) {
+      slab = mmap (nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (slab != MAP_FAILED) ++hugepage_slabs;
+   }
+   if (slab == MAP_FAILED) {
+      slab = mmap (nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (slab == MAP_FAILED) throw bad_alloc();
+      if (use_hugepages) madvise (slab, SLAB_SIZE, MADV_HUGEPAGE);
+   }
+   ++slabs;
+   for (size_t offset = 0; offset < SLAB_SIZE; offset += BUFFER_SIZE) {
+      free_list.push_back ((char*) slab + offset);
+   }
+}
+
+char* io_buffer_pool::acquire() {
+   ++acquires;
+   size_t now_in_use = ++in_use;
+   size_t peak = peak_in_use;
+   while (now_in_use > peak
+          and not peak_in_use.compare_exchange_weak (peak, now_in_use)) {
+   }
+   if (not thread_cache.buffers.empty()) {
+      char* buffer = thread_cache.buffers.back();
+      thread_cache.buffers.pop_back();
+      return buffer;
+   }
+   lock_guard<mutex> guard (lock);
+   if (free_list.empty()) grow();
+   // Refill half the thread cache while holding the lock anyway.
+   while (thread_cache.buffers.size() < THREAD_CACHE_SIZE / 2
+          and free_list.size() > 1) {
+      thread_cache.buffers.push_back (free_list.back());
+      free_list.pop_back();
+   }
+   char* buffer = free_list.back();
+   free_list.pop_back();
+   return buffer;
+}
+
+void io_buffer_pool::release (char* buffer) {
+   --in_use;
+   if (thread_cache.buffers.size() < THREAD_CACHE_SIZE) {
+      thread_cache.buffers.push_back (buffer);
+      return;
+   }
+   lock_guard<mutex> guard (lock);
+   free_list.push_back (buffer);
+}
+
+io_pool_stats io_buffer_pool::stats() const {
+   io_pool_stats stats;
+   lock_guard<mutex> guard (lock);
+   stats.slabs = slabs;
+   stats.hugepage_slabs = hugepage_slabs;
+   stats.buffers = slabs * (SLAB_SIZE / BUFFER_SIZE);
+   stats.in_use = in_use;
+   stats.peak_in_use = peak_in_use;
+   stats.free = free_list.size();
+   // in_use moves without the lock, so this is only approximate.
+   if (stats.free + stats.in_use < stats.buffers) {
+      stats.thread_cached = stats.buffers - stats.free - stats.in_use;
+   }
+   stats.acquires = acquires;
+   return stats;
+}
+
+io_buffer& io_buffer::operator= (io_buffer&& that) {
+   if (this != &that) {
+      if (buffer != nullptr) io_buffer_pool::instance().release (buffer);
+      buffer = that.buffer;
+      that.buffer = nullptr;
+   }
+   return *this;
+}
+
+void* cix_arena::allocate (size_t size, size_t align) {
+   if (size > io_buffer::size()) {
+      large.emplace_back (new char[size]);
+      return large.back().get();
+   }
+   size_t offset = (used + align - 1) / align * align;
+   if (offset + size > io_buffer::size()) {
+      blocks.emplace_back();
+      offset = 0;
+   }
+   used = offset + size;
+   return blocks.back().data() + offset;
+}
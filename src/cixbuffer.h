@@ -0,0 +1,119 @@
+// $Id$
+
+//
+// Transfer buffers.
+// Every file and socket transfer moves data through fixed size,
+// page aligned buffers taken from one shared pool instead of
+// allocating a buffer the size of the file.  The pool maps 2 MiB
+// slabs, backed by huge pages when $CIX_HUGEPAGES is set, and each
+// thread keeps a few free buffers of its own so that most acquire
+// and release calls take no lock.
+//
+
+#ifndef __CIXBUFFER_H__
+#define __CIXBUFFER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+struct io_pool_stats {
+   size_t slabs {0};
+   size_t hugepage_slabs {0};
+   size_t buffers {0};
+   size_t in_use {0};
+   size_t peak_in_use {0};
+   size_t free {0};          // in the shared free list
+   size_t thread_cached {0}; // held by per-thread caches
+   size_t acquires {0};
+};
+
+// One "name value" line per counter.
+string to_string (const io_pool_stats& stats);
+
+//
+// class io_buffer_pool
+// the process wide pool.  Buffers are never returned to the system.
+//
+
+class io_buffer_pool {
+   public:
+      static constexpr size_t BUFFER_SIZE = 0x10000;
+      static constexpr size_t SLAB_SIZE = 0x200000;
+      static constexpr size_t THREAD_CACHE_SIZE = 8;
+      static io_buffer_pool& instance();
+      char* acquire();
+      void release (char* buffer);
+      io_pool_stats stats() const;
+   private:
+      mutable mutex lock;
+      vector<char*> free_list;
+      bool use_hugepages;
+      size_t slabs {0};
+      size_t hugepage_slabs {0};
+      atomic<size_t> in_use {0};
+      atomic<size_t> peak_in_use {0};
+      atomic<size_t> acquires {0};
+      io_buffer_pool();
+      void grow(); // called with lock held
+      friend struct io_thread_cache;
+};
+
+//
+// class io_buffer
+// one pooled buffer, returned to the pool by the destructor
+//
+
+class io_buffer {
+   private:
+      char* buffer;
+   public:
+      io_buffer(): buffer (io_buffer_pool::instance().acquire()) {}
+      ~io_buffer() {
+         if (buffer != nullptr) io_buffer_pool::instance().release (buffer);
+      }
+      io_buffer (io_buffer&& that): buffer (that.buffer) {
+         that.buffer = nullptr;
+      }
+      io_buffer& operator= (io_buffer&& that);
+      io_buffer (const io_buffer&) = delete;
+      io_buffer& operator= (const io_buffer&) = delete;
+      char* data() { return buffer; }
+      const char* data() const { return buffer; }
+      static constexpr size_t size() { return io_buffer_pool::BUFFER_SIZE; }
+};
+
+//
+// class cix_arena
+// per-request bump allocator for headers and small payloads.
+// Everything is released at once when the arena goes away.
+// Blocks come from the buffer pool; an allocation larger than a
+// block gets its own.
+//
+
+class cix_arena {
+   private:
+      vector<io_buffer> blocks;
+      vector<unique_ptr<char[]>> large;
+      size_t used {io_buffer::size()};
+      cix_arena (const cix_arena&) = delete;
+      cix_arena& operator= (const cix_arena&) = delete;
+   public:
+      cix_arena() {}
+      void* allocate (size_t size, size_t align = alignof (max_align_t));
+      template <typename T>
+      T* make() {
+         static_assert (is_trivially_destructible<T>::value,
+                        "cix_arena never runs destructors");
+         return new (allocate (sizeof (T), alignof (T))) T();
+      }
+};
+
+#endif
+
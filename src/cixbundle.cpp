@@ -0,0 +1,311 @@
+// $Id$
+
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cixbundle.h"
+
+// Files opened and advised ahead of the one being sent.
+static constexpr size_t READAHEAD_FILES = 8;
+
+vector<string> expand_globs (const vector<string>& patterns) {
+   vector<string> filenames;
+   for (const auto& pattern: patterns) {
+      glob_t matches;
+      int rc = glob (pattern.c_str(), GLOB_NOCHECK, nullptr, &matches);
+      if (rc == 0) {
+         for (size_t index = 0; index < matches.gl_pathc; ++index) {
+            filenames.push_back (matches.gl_pathv[index]);
+         }
+      }else {
+         filenames.push_back (pattern);
+      }
+      globfree (&matches);
+   }
+   return filenames;
+}
+
+string join_lines (const vector<string>& lines) {
+   string text;
+   for (const auto& line: lines) text.append (line).append ("\n");
+   return text;
+}
+
+vector<string> split_lines (const string& text) {
+   vector<string> lines;
+   size_t start = 0;
+   while (start < text.size()) {
+      size_t end = text.find ('\n', start);
+      if (end == string::npos) end = text.size();
+      if (end > start) lines.push_back (text.substr (start, end - start));
+      start = end + 1;
+   }
+   return lines;
+}
+
+vector<vector<string>> batch_names (const vector<string>& names) {
+   vector<vector<string>> batches;
+   size_t batch_size = CIX_MAX_NAMES_SIZE;
+   for (const auto& name: names) {
+      if (batch_size + name.size() + 1 > CIX_MAX_NAMES_SIZE) {
+         batches.emplace_back();
+         batch_size = 0;
+      }
+      batches.back().push_back (name);
+      batch_size += name.size() + 1;
+   }
+   return batches;
+}
+
+struct open_entry {
+   string filename;
+   int fd;
+   int error;
+   off_t size;
+   time_t mtime;
+};
+
+static open_entry open_ahead (const string& dirname,
+                              const string& filename) {
+   open_entry entry {filename, -1, 0, 0, 0};
+   struct stat stat_buf;
+   if (filename.size() >= CIX_FILENAME_SIZE) {
+      entry.error = ENAMETOOLONG;
+      return entry;
+   }
+   entry.fd = open (join_path (dirname, filename).c_str(),
+                    O_RDONLY | O_CLOEXEC);
+   if (entry.fd < 0 or fstat (entry.fd, &stat_buf) < 0) {
+      entry.error = errno;
+   }else if (not S_ISREG (stat_buf.st_mode)) {
+      entry.error = EISDIR;
+   }else if (stat_buf.st_size > UINT32_MAX) {
+      entry.error = EFBIG;
+   }else {
+      entry.size = stat_buf.st_size;
+      entry.mtime = stat_buf.st_mtime;
+      posix_fadvise (entry.fd, 0, 0, POSIX_FADV_WILLNEED);
+      return entry;
+   }
+   if (entry.fd >= 0) close (entry.fd);
+   entry.fd = -1;
+   return entry;
+}
+
+static void send_entry (base_socket& socket, const open_entry& entry,
+                        io_buffer& buffer) {
+   cix_header header;
+   header.cix_command = CIX_MTIME;
+   header.cix_nbytes = entry.mtime;
+   strcpy (header.cix_filename, entry.filename.c_str());
+   send_packet (socket, &header, sizeof header);
+   header.cix_command = CIX_FILE;
+   header.cix_nbytes = entry.size;
+   send_packet (socket, &header, sizeof header);
+   off_t remaining = entry.size;
+   while (remaining > 0) {
+      size_t wanted = min<off_t> (remaining, buffer.size());
+      ssize_t nbytes = read (entry.fd, buffer.data(), wanted);
+      if (nbytes <= 0) {
+         // The file shrank while being sent:  pad to the size in
+         // the header so the stream stays framed.
+         memset (buffer.data(), 0, wanted);
+         nbytes = wanted;
+      }
+      send_packet (socket, buffer.data(), nbytes);
+      remaining -= nbytes;
+   }
+}
+
+bundle_result send_bundle (base_socket& socket,
+                           const vector<string>& filenames,
+                           const string& dirname) {
+   bundle_result result;
+   io_buffer buffer;
+   deque<open_entry> window;
+   size_t next = 0;
+   try {
+      while (next < filenames.size() or window.size() > 0) {
+         while (next < filenames.size()
+                and window.size() < READAHEAD_FILES) {
+            window.push_back (open_ahead (dirname, filenames[next++]));
+         }
+         open_entry entry = window.front();
+         window.pop_front();
+         if (entry.fd < 0) {
+            cix_header header;
+            header.cix_command = CIS_NAK;
+            header.cix_nbytes = entry.error;
+            strncpy (header.cix_filename, entry.filename.c_str(),
+                     CIX_FILENAME_SIZE - 1);
+            send_packet (socket, &header, sizeof header);
+            result.failed.push_back ({entry.filename, entry.error});
+            continue;
+         }
+         send_entry (socket, entry, buffer);
+         close (entry.fd);
+         ++result.files;
+         result.bytes += entry.size;
+      }
+   }catch (socket_error&) {
+      for (const auto& entry: window) {
+         if (entry.fd >= 0) close (entry.fd);
+      }
+      throw;
+   }
+   cix_header header;
+   header.cix_command = CIS_ACK;
+   header.cix_nbytes = result.files + result.failed.size();
+   send_packet (socket, &header, sizeof header);
+   return result;
+}
+
+void make_parent_dirs (const string& filename) {
+   for (size_t slash = filename.find ('/', 1); slash != string::npos;
+        slash = filename.find ('/', slash + 1)) {
+      mkdir (filename.substr (0, slash).c_str(), 0777);
+   }
+}
+
+bool safe_path (const string& filename) {
+   if (filename.size() == 0 or filename[0] == '/') return false;
+   for (size_t start = 0; start <= filename.size(); ) {
+      size_t slash = filename.find ('/', start);
+      if (slash == string::npos) slash = filename.size();
+      if (filename.compare (start, slash - start, "..") == 0) {
+         return false;
+      }
+      start = slash + 1;
+   }
+   return true;
+}
+
+bundle_writer::bundle_writer (const string& suffix,
+                              const string& directory):
+               suffix (suffix), directory (directory),
+               worker (&bundle_writer::write_entries, this) {
+}
+
+bundle_writer::~bundle_writer() {
+   finish();
+}
+
+void bundle_writer::push (const string& filename,
+                          vector<io_buffer>&& chunks, size_t size,
+                          time_t mtime, bool append) {
+   unique_lock<mutex> guard (lock);
+   changed.wait (guard, [this] {
+      return queued_bytes < MAX_QUEUED_BYTES or queue.empty();
+   });
+   queued_bytes += size;
+   queue.push_back ({filename, move (chunks), size, mtime, append});
+   changed.notify_all();
+}
+
+vector<bundle_status> bundle_writer::finish() {
+   {
+      lock_guard<mutex> guard (lock);
+      closing = true;
+      changed.notify_all();
+   }
+   if (worker.joinable()) worker.join();
+   return failed;
+}
+
+// Returns 0 or errno.
+int bundle_writer::write_entry (const entry& next) {
+   if (not safe_path (next.filename)) return EACCES;
+   string path = join_path (directory, next.filename) + suffix;
+   make_parent_dirs (path);
+   ofstream fileout (path, next.append ? ios::out | ios::binary | ios::app
+                                       : ios::out | ios::binary);
+   if (!fileout.is_open()) return errno;
+   for (size_t remaining = next.size, index = 0; remaining > 0;
+        ++index) {
+      size_t nbytes = min (remaining, io_buffer::size());
+      fileout.write (next.chunks[index].data(), nbytes);
+      remaining -= nbytes;
+   }
+   fileout.close();
+   if (fileout.fail()) return EIO;
+   if (next.mtime != 0) {
+      timespec times[2] = {{0, UTIME_OMIT}, {next.mtime, 0}};
+      utimensat (AT_FDCWD, path.c_str(), times, 0);
+   }
+   return 0;
+}
+
+void bundle_writer::write_entries() {
+   for (;;) {
+      entry next;
+      {
+         unique_lock<mutex> guard (lock);
+         changed.wait (guard, [this] {
+            return closing or not queue.empty();
+         });
+         if (queue.empty()) return;
+         next = move (queue.front());
+         queue.pop_front();
+      }
+      // Once a piece fails, the rest of that file is dropped.
+      if (not next.append or next.filename != last_failed) {
+         int error = write_entry (next);
+         if (error != 0) {
+            failed.push_back ({next.filename, error});
+            last_failed = next.filename;
+         }
+      }
+      next.chunks.clear();
+      lock_guard<mutex> guard (lock);
+      queued_bytes -= next.size;
+      changed.notify_all();
+   }
+}
+
+bundle_result recv_bundle (base_socket& socket, bundle_writer& writer) {
+   bundle_result result;
+   time_t mtime = 0;
+   for (;;) {
+      cix_header header;
+      recv_packet (socket, &header, sizeof header);
+      header.cix_filename[CIX_FILENAME_SIZE - 1] = '\0';
+      if (header.cix_command == CIS_ACK) break;
+      if (header.cix_command == CIX_MTIME) {
+         mtime = header.cix_nbytes;
+      }else if (header.cix_command == CIS_NAK) {
+         result.failed.push_back ({header.cix_filename,
+                                   int (header.cix_nbytes)});
+      }else if (header.cix_command == CIX_FILE) {
+         size_t remaining = header.cix_nbytes;
+         bool append = false;
+         do {
+            size_t piece = min (remaining, bundle_writer::MAX_PIECE_BYTES);
+            vector<io_buffer> chunks;
+            for (size_t left = piece; left > 0; ) {
+               size_t nbytes = min (left, io_buffer::size());
+               chunks.emplace_back();
+               recv_packet (socket, chunks.back().data(), nbytes);
+               left -= nbytes;
+            }
+            remaining -= piece;
+            writer.push (header.cix_filename, move (chunks), piece,
+                         remaining == 0 ? mtime : 0, append);
+            append = true;
+         }while (remaining > 0);
+         ++result.files;
+         result.bytes += header.cix_nbytes;
+         mtime = 0;
+      }else {
+         throw socket_error ("bundle: unexpected header");
+      }
+   }
+   return result;
+}
@@ -0,0 +1,113 @@
+// $Id$
+
+//
+// Multi-file bundles for MGET and MPUT.
+// A bundle is a stream of CIX_FILE headers, each followed by its
+// payload, ending with a CIS_ACK header whose cix_nbytes is the
+// number of entries.  Each CIX_FILE is preceded by a CIX_MTIME
+// header so the receiver can keep the modification time.  An entry
+// that could not be read is sent as a CIS_NAK header carrying errno
+// in cix_nbytes.  One bundle replaces a header round trip per file.
+//
+
+#ifndef __CIXBUNDLE_H__
+#define __CIXBUNDLE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "cixbuffer.h"
+#include "cixlib.h"
+#include "sockets.h"
+
+struct bundle_status {
+   string filename;
+   int error;
+};
+
+struct bundle_result {
+   size_t files {0};
+   size_t bytes {0};
+   vector<bundle_status> failed;
+};
+
+// Expand shell wildcards.  A pattern that matches nothing is kept,
+// so that it is reported as a failed entry.
+vector<string> expand_globs (const vector<string>& patterns);
+
+// mkdir -p for every directory leading up to filename.
+void make_parent_dirs (const string& filename);
+
+// A relative path with no ".." in it, safe to create from a name
+// the peer sent.
+bool safe_path (const string& filename);
+
+// Patterns travel as the newline separated payload of a header.
+string join_lines (const vector<string>& lines);
+vector<string> split_lines (const string& text);
+
+// Consecutive runs of names whose payloads fit CIX_MAX_NAMES_SIZE.
+vector<vector<string>> batch_names (const vector<string>& names);
+
+// Send each file as an entry, reading a few files ahead of the
+// socket, then the terminating CIS_ACK.  Files are read from under
+// dirname and sent under their names relative to it.
+bundle_result send_bundle (base_socket& socket,
+                           const vector<string>& filenames,
+                           const string& dirname = ".");
+
+//
+// class bundle_writer
+// writes received entries to disk on a separate thread so that
+// the socket keeps being drained while the disk is busy.  Each is
+// stored under the directory as its name plus the suffix; unsafe
+// names are refused.
+//
+
+class bundle_writer {
+   public:
+      // Larger entries are queued a piece at a time, so that one
+      // entry can not hold more than this in pool buffers.
+      static constexpr size_t MAX_PIECE_BYTES = 4 << 20;
+   private:
+      static constexpr size_t MAX_QUEUED_BYTES = 64 << 20;
+      struct entry {
+         string filename;
+         vector<io_buffer> chunks;
+         size_t size;
+         time_t mtime;
+         bool append;   // a later piece of the same file
+      };
+      string suffix;
+      string directory;
+      mutex lock;
+      condition_variable changed;
+      deque<entry> queue;
+      size_t queued_bytes {0};
+      bool closing {false};
+      vector<bundle_status> failed;
+      string last_failed;
+      thread worker;
+      int write_entry (const entry& next);
+      void write_entries();
+      bundle_writer (const bundle_writer&) = delete;
+      bundle_writer& operator= (const bundle_writer&) = delete;
+   public:
+      bundle_writer (const string& suffix = "",
+                     const string& directory = ".");
+      ~bundle_writer();
+      void push (const string& filename, vector<io_buffer>&& chunks,
+                 size_t size, time_t mtime = 0, bool append = false);
+      vector<bundle_status> finish(); // wait for the queue to drain
+};
+
+// Receive entries up to the terminating CIS_ACK.
+bundle_result recv_bundle (base_socket& socket, bundle_writer& writer);
+
+#endif
+
@@ -0,0 +1,101 @@
+// $Id$
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+using namespace std;
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cixcache.h"
+
+string get_cix_cache_dir() {
+   char* dirname = getenv ("CIX_CACHE_DIR");
+   return dirname == nullptr ? "" : dirname;
+}
+
+cix_cache::cix_cache (const string& dirname, const string& server):
+           dirname (dirname), server (server) {
+   mkdir (dirname.c_str(), 0777);
+}
+
+string cix_cache::entry_path (const string& filename,
+                              const string& suffix) const {
+   uint64_t hash = fnv1a_hash (server.c_str(), server.size() + 1);
+   hash = fnv1a_hash (filename.c_str(), filename.size(), hash);
+   ostringstream path;
+   path << dirname << "/" << hex << hash << suffix;
+   return path.str();
+}
+
+// The meta file repeats the server and path, so that a hash
+// collision reads as a miss.
+bool cix_cache::lookup (const string& filename,
+                        manifest_entry& entry) const {
+   ifstream meta (entry_path (filename, ".meta"));
+   string meta_server;
+   string meta_filename;
+   meta >> entry.size >> entry.mtime >> hex >> entry.checksum >> dec
+        >> meta_server;
+   meta.get();
+   getline (meta, meta_filename);
+   if (meta.fail() or meta_server != server
+                   or meta_filename != filename) return false;
+   struct stat stat_buf;
+   if (stat (data_path (filename).c_str(), &stat_buf) < 0) return false;
+   return uint64_t (stat_buf.st_size) == entry.size;
+}
+
+string cix_cache::temp_path (const string& path) const {
+   return path + ".tmp." + to_string (getpid());
+}
+
+ofstream cix_cache::open_store (const string& filename) const {
+   return ofstream (temp_path (data_path (filename)),
+                    ios::out | ios::binary);
+}
+
+void cix_cache::abort_store (const string& filename) const {
+   unlink (temp_path (data_path (filename)).c_str());
+}
+
+// Both files are written to temporary names and renamed, data
+// before meta, so that an interrupted store never leaves a meta
+// file describing the wrong data.
+void cix_cache::commit_store (const string& filename,
+                              const manifest_entry& entry) {
+   string data_name = data_path (filename);
+   unlink (entry_path (filename, ".meta").c_str());
+   rename (temp_path (data_name).c_str(), data_name.c_str());
+   write_meta (filename, entry);
+}
+
+// The server found the contents unchanged but with a new mtime.
+void cix_cache::touch (const string& filename, int64_t mtime) {
+   manifest_entry entry;
+   if (not lookup (filename, entry) or entry.mtime == mtime) return;
+   entry.mtime = mtime;
+   write_meta (filename, entry);
+}
+
+void cix_cache::write_meta (const string& filename,
+                            const manifest_entry& entry) const {
+   string meta_name = entry_path (filename, ".meta");
+   string meta_temp = temp_path (meta_name);
+   {
+      ofstream meta (meta_temp);
+      meta << entry.size << " " << entry.mtime << " " << hex
+           << entry.checksum << dec << " " << server << " "
+           << filename << "\n";
+      if (meta.fail()) {
+         meta.close();
+         unlink (meta_temp.c_str());
+         return;
+      }
+   }
+   rename (meta_temp.c_str(), meta_name.c_str());
+}
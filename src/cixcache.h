@@ -0,0 +1,52 @@
+// $Id$
+
+//
+// class cix_cache
+// persistent client side copies of files fetched with GET, keyed by
+// server and path.  Each entry is a pair of files in the cache
+// directory named by a hash of the key:  <key>.data holds the
+// contents and <key>.meta the size, mtime and checksum that are
+// sent back to the server in a conditional GET.
+//
+
+#ifndef __CIXCACHE_H__
+#define __CIXCACHE_H__
+
+#include <fstream>
+#include <string>
+using namespace std;
+
+#include "cixmanifest.h"
+
+class cix_cache {
+   private:
+      string dirname;
+      string server;
+      string entry_path (const string& filename,
+                         const string& suffix) const;
+      void write_meta (const string& filename,
+                       const manifest_entry& entry) const;
+      // Clients may share the directory, so temporaries carry the pid.
+      string temp_path (const string& path) const;
+   public:
+      // server identifies the daemon, e.g. "host:port".
+      cix_cache (const string& dirname, const string& server);
+      bool lookup (const string& filename, manifest_entry& entry) const;
+      // Contents are written to the stream from open_store while
+      // they arrive, then commit_store makes them the entry, or
+      // abort_store throws them away.
+      ofstream open_store (const string& filename) const;
+      void commit_store (const string& filename,
+                         const manifest_entry& entry);
+      void abort_store (const string& filename) const;
+      void touch (const string& filename, int64_t mtime);
+      string data_path (const string& filename) const {
+         return entry_path (filename, ".data");
+      }
+};
+
+// The cache directory from $CIX_CACHE_DIR, or "" if caching is off.
+string get_cix_cache_dir();
+
+#endif
+
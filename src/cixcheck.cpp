@@ -0,0 +1,304 @@
+// $Id$
+
+//
+// cixcheck
+// checks the pure parts of the library:  path safety, port and
+// address parsing, manifests, the hash ring, event coalescing and
+// trace files.  Prints each failed check and exits 1 if any did.
+// Run by make check.
+//
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cixbundle.h"
+#include "cixjournal.h"
+#include "cixlib.h"
+#include "cixmanifest.h"
+#include "cixring.h"
+#include "cixtrace.h"
+#include "logstream.h"
+
+logstream elog (cerr);
+
+static size_t checks = 0;
+static size_t failures = 0;
+
+#define CHECK(condition) check (condition, #condition, __LINE__)
+
+static void check (bool passed, const char* condition, int line) {
+   ++checks;
+   if (passed) return;
+   ++failures;
+   cerr << "cixcheck.cpp:" << line << ": failed: " << condition << endl;
+}
+
+static bool throws_socket_error (void (*test)()) {
+   try {
+      test();
+   }catch (socket_error&) {
+      return true;
+   }
+   return false;
+}
+
+static void check_safe_path() {
+   CHECK (safe_path ("file"));
+   CHECK (safe_path ("dir/file"));
+   CHECK (safe_path ("dir/..file"));
+   CHECK (safe_path ("a/b../c"));
+   CHECK (not safe_path (""));
+   CHECK (not safe_path ("/etc/passwd"));
+   CHECK (not safe_path (".."));
+   CHECK (not safe_path ("../file"));
+   CHECK (not safe_path ("dir/../../file"));
+   CHECK (not safe_path ("dir/.."));
+}
+
+static void check_ports() {
+   CHECK (parse_port ("1") == 1);
+   CHECK (parse_port ("50000") == 50000);
+   CHECK (parse_port ("65535") == 65535);
+   CHECK (throws_socket_error ([] { parse_port (""); }));
+   CHECK (throws_socket_error ([] { parse_port ("0"); }));
+   CHECK (throws_socket_error ([] { parse_port ("65536"); }));
+   CHECK (throws_socket_error ([] { parse_port ("-1"); }));
+   CHECK (throws_socket_error ([] { parse_port ("+80"); }));
+   CHECK (throws_socket_error ([] { parse_port ("80x"); }));
+   CHECK (throws_socket_error ([] { parse_port (" 80"); }));
+   CHECK (throws_socket_error ([] {
+      parse_port ("99999999999999999999");
+   }));
+}
+
+static void check_split_host_port() {
+   using host_port = pair<string,in_port_t>;
+   CHECK (split_host_port ("host", 50000) == host_port ("host", 50000));
+   CHECK (split_host_port ("host:7", 50000) == host_port ("host", 7));
+   CHECK (split_host_port ("::1", 50000) == host_port ("::1", 50000));
+   CHECK (split_host_port ("[::1]", 50000) == host_port ("::1", 50000));
+   CHECK (split_host_port ("[::1]:8", 50000) == host_port ("::1", 8));
+   CHECK (throws_socket_error ([] { split_host_port ("[::1", 1); }));
+   CHECK (throws_socket_error ([] { split_host_port ("host:", 1); }));
+   CHECK (throws_socket_error ([] {
+      split_host_port ("host:70000", 1);
+   }));
+   CHECK (split_server_list ("a,b:2,,[::1]", 5)
+          == vector<string> ({"a:5", "b:2", "[::1]:5"}));
+}
+
+static void check_exact_names() {
+   cix_header header;
+   CHECK (not is_exact_names (header));
+   CHECK (set_exact_names (header));
+   CHECK (is_exact_names (header));
+   CHECK (exact_names_dir (header) == ".");
+   CHECK (set_exact_names (header, "../dir"));
+   CHECK (is_exact_names (header));
+   CHECK (exact_names_dir (header) == "../dir");
+   CHECK (not set_exact_names (header, string (CIX_FILENAME_SIZE, 'x')));
+   strcpy (header.cix_filename, "=exactly");
+   CHECK (not is_exact_names (header));
+   CHECK (join_path (".", "f") == "f");
+   CHECK (join_path ("d", "f") == "d/f");
+   CHECK (join_path ("/", "f") == "/f");
+   CHECK (join_path ("d/", "f") == "d/f");
+   CHECK (cix_route_name ("f.gotput") == "f");
+   CHECK (cix_route_name (".gotput") == ".gotput");
+   CHECK (cix_route_name ("f.got") == "f.got");
+}
+
+static void check_manifest() {
+   manifest files;
+   files["a"] = {3, 100, 0};
+   files["dir/with space"] = {0, -5, 0xabcdef};
+   files["z"] = {1ULL << 40, 1700000000, 1};
+   manifest parsed = parse_manifest (format_manifest (files));
+   CHECK (parsed.size() == files.size());
+   for (const auto& file: files) {
+      const auto& itor = parsed.find (file.first);
+      CHECK (itor != parsed.end()
+             and itor->second.size == file.second.size
+             and itor->second.mtime == file.second.mtime
+             and itor->second.checksum == file.second.checksum);
+   }
+   CHECK (parse_manifest ("").empty());
+   CHECK (parse_manifest ("junk\n1 2\n3 4 5 \n").empty());
+   CHECK (same_file ({1, 2, 0}, {1, 2, 0}));
+   CHECK (not same_file ({1, 2, 0}, {1, 3, 0}));
+   CHECK (same_file ({1, 2, 7}, {1, 3, 7}));
+   CHECK (not same_file ({1, 2, 7}, {1, 2, 8}));
+   CHECK (not same_file ({1, 2, 7}, {2, 2, 7}));
+}
+
+// Names are relative to the directory walked, however it is named.
+static void check_build_manifest() {
+   char base[] = "/tmp/cixcheck.XXXXXX";
+   if (mkdtemp (base) == nullptr) {
+      CHECK (not "mkdtemp");
+      return;
+   }
+   string dirname = base;
+   mkdir ((dirname + "/sub").c_str(), 0777);
+   FILE* file = fopen ((dirname + "/sub/f").c_str(), "w");
+   if (file != nullptr) {
+      fputs ("data", file);
+      fclose (file);
+   }
+   for (const auto& name: {dirname, dirname + "/", dirname + "/sub/.."}) {
+      manifest files = build_manifest (name, true);
+      CHECK (files.size() == 1 and files.count ("sub/f") == 1
+             and files["sub/f"].size == 4
+             and files["sub/f"].checksum == fnv1a_hash ("data", 4));
+   }
+   unlink ((dirname + "/sub/f").c_str());
+   rmdir ((dirname + "/sub").c_str());
+   rmdir (base);
+}
+
+static void check_ring() {
+   cix_ring ring;
+   bool refused = false;
+   try {
+      ring.lookup ("f");
+   }catch (runtime_error&) {
+      refused = true;
+   }
+   CHECK (refused);
+   for (const auto& node: {"a:1", "b:1", "c:1"}) ring.add (node);
+   CHECK (ring.contains ("b:1") and not ring.contains ("d:1"));
+   vector<string> paths;
+   for (int index = 0; index < 1000; ++index) {
+      paths.push_back ("file" + to_string (index));
+   }
+   vector<string> before;
+   for (const auto& path: paths) before.push_back (ring.lookup (path));
+   // Members added in another order give the same owners.
+   cix_ring reordered;
+   for (const auto& node: {"c:1", "a:1", "b:1"}) reordered.add (node);
+   bool same = true;
+   for (size_t index = 0; index < paths.size(); ++index) {
+      same = same and reordered.lookup (paths[index]) == before[index];
+   }
+   CHECK (same);
+   // A new member only takes paths; nothing moves between the others.
+   ring.add ("d:1");
+   size_t moved = 0;
+   bool only_to_new = true;
+   for (size_t index = 0; index < paths.size(); ++index) {
+      const string& owner = ring.lookup (paths[index]);
+      if (owner == before[index]) continue;
+      ++moved;
+      only_to_new = only_to_new and owner == "d:1";
+   }
+   CHECK (only_to_new);
+   CHECK (moved > 0 and moved < paths.size() / 2);
+   // Removing it puts every path back.
+   ring.remove ("d:1");
+   same = true;
+   for (size_t index = 0; index < paths.size(); ++index) {
+      same = same and ring.lookup (paths[index]) == before[index];
+   }
+   CHECK (same);
+}
+
+static cix_event make_event (uint64_t seq, uint8_t kind,
+                             const string& filename) {
+   cix_event event;
+   event.seq = seq;
+   event.kind = kind;
+   strncpy (event.filename, filename.c_str(), CIX_FILENAME_SIZE - 1);
+   return event;
+}
+
+static void check_coalesce_events() {
+   vector<cix_event> events {
+      make_event (1, CIX_EVENT_CREATE, "d/new"),
+      make_event (2, CIX_EVENT_MODIFY, "d/new"),
+      make_event (3, CIX_EVENT_MODIFY, "d/old"),
+      make_event (4, CIX_EVENT_DELETE, "d/old"),
+      make_event (5, CIX_EVENT_CREATE, "d/temp"),
+      make_event (6, CIX_EVENT_DELETE, "d/temp"),
+      make_event (7, CIX_EVENT_LOST, ""),
+      make_event (8, CIX_EVENT_MODIFY, "other"),
+      make_event (9, CIX_EVENT_DELETE, "d/back"),
+      make_event (10, CIX_EVENT_CREATE, "d/back"),
+   };
+   vector<cix_event> batch = coalesce_events (events, "d/");
+   CHECK (batch.size() == 4);
+   if (batch.size() != 4) return;
+   CHECK (batch[0].seq == 2 and batch[0].kind == CIX_EVENT_CREATE
+          and string (batch[0].filename) == "d/new");
+   CHECK (batch[1].seq == 4 and batch[1].kind == CIX_EVENT_DELETE
+          and string (batch[1].filename) == "d/old");
+   CHECK (batch[2].seq == 7 and batch[2].kind == CIX_EVENT_LOST);
+   CHECK (batch[3].seq == 10 and batch[3].kind == CIX_EVENT_MODIFY
+          and string (batch[3].filename) == "d/back");
+   CHECK (coalesce_events (events, "").size() == 5);
+   CHECK (coalesce_events ({}, "").empty());
+}
+
+static void check_read_trace() {
+   char path[] = "/tmp/cixcheck.trace.XXXXXX";
+   int fd = mkstemp (path);
+   if (fd < 0) {
+      CHECK (not "mkstemp");
+      return;
+   }
+   cix_trace_record records[2];
+   records[0].cix_command = CIX_GET;
+   records[0].duration_ns = 42;
+   strcpy (records[0].cix_filename, "f");
+   records[1].cix_command = CIX_PUT;
+   records[1].reply_nbytes = 3;
+   bool written = write (fd, "CIXTRC01", 8) == 8
+              and write (fd, records, sizeof records) == sizeof records
+              and write (fd, records, 5) == 5; // cut short:  ignored
+   close (fd);
+   CHECK (written);
+   vector<cix_trace_record> read = read_trace (path);
+   CHECK (read.size() == 2);
+   if (read.size() == 2) {
+      CHECK (read[0].cix_command == CIX_GET and read[0].duration_ns == 42
+             and string (read[0].cix_filename) == "f");
+      CHECK (read[1].cix_command == CIX_PUT and read[1].reply_nbytes == 3);
+   }
+   CHECK (throws_socket_error ([] {
+      read_trace ("/nonexistent/cixcheck.trace");
+   }));
+   fd = open (path, O_WRONLY | O_TRUNC);
+   if (fd >= 0) {
+      CHECK (write (fd, "NOTATRACE", 9) == 9);
+      close (fd);
+   }
+   bool refused = false;
+   try {
+      read_trace (path);
+   }catch (socket_error&) {
+      refused = true;
+   }
+   CHECK (refused);
+   unlink (path);
+}
+
+int main() {
+   check_safe_path();
+   check_ports();
+   check_split_host_port();
+   check_exact_names();
+   check_manifest();
+   check_build_manifest();
+   check_ring();
+   check_coalesce_events();
+   check_read_trace();
+   cout << checks - failures << " of " << checks << " checks passed"
+        << endl;
+   return failures == 0 ? 0 : 1;
+}
@@ -1,11 +1,22 @@
 // $Id: cixclient.cpp,v 1.5 2014-05-28 10:33:19-07 - - $
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <unordered_map>
+#include <cctype>
 #include <cerrno>
+#include <cstdlib>
 using namespace std;
 
 #include <libgen.h>
@@ -14,19 +25,44 @@ using namespace std;
 
 #include "logstream.h"
 #include "sockets.h"
+#include "cixbuffer.h"
+#include "cixbundle.h"
+#include "cixcache.h"
 #include "cixlib.h"
+#include "cixmanifest.h"
+#include "cixring.h"
+#include "libcix.h"
 
 logstream elog (cerr);
 struct cixclient_exit: public exception {};
 
 void cix_help() {
    static vector<string> help = {
+      "cp src dest  - Copy a remote file on the server.",
       "exit         - Exit the program.  Equivalent to EOF.",
-      "get filename - Copy remote file to local host.",
+      "get filename - Copy remote files to local host.",
+      "               Cached in $CIX_CACHE_DIR if set.",
       "help         - Print help summary.",
+      "join server  - Add host:port to the cluster and rebalance.",
+      "leave server - Move files off host:port and drop it.",
       "ls           - List names of files on remote server.",
-      "put filename - Copy local file to remote host.",
-      "rm filename  - Remove file from remote server.",
+      "mget pattern - Copy matching remote files in one bundle.",
+      "mput pattern - Copy matching local files in one bundle.",
+      "mv src dest  - Rename a remote file on the server.",
+      "mirror dir   - Make local dir a copy of remote dir.",
+      "put filename - Copy local files to remote host.",
+      "rm pattern   - Remove matching files from remote server.",
+      "               get and put take several names and",
+      "               run them at once.",
+      "stats        - Show buffer pool counters of this session's",
+      "               connection to each server.",
+      "sync dir     - Copy newer files between local and remote dir.",
+      "               mirror and sync take -c to compare checksums",
+      "               and -j n for n parallel connections.",
+      "watch prefix - Print changes to remote files as they happen.",
+      "               It holds the prompt until the daemons go away;",
+      "               interrupt (^C) to quit.",
+      "               -s seq resumes after the numbered change.",
    };
    for (const auto& line: help) cout << line << endl;
 }
@@ -43,100 +79,760 @@ vector<string> split (const string& line, const string& delimiters) {
    return words;
 }
 
-void cix_put (client_socket& server, vector<string>& params) {
-   //if (params.size() != 2) 
-   //elog << params << "missing filenames" << endl;
-   cix_header header;
-   ifstream file(params[1], ios::in|ios::binary|ios::ate); 
+//
+// class cix_cluster
+// the blocking connections of the bundle commands and of the join
+// and leave relay, opened when one of them first needs a daemon.
+// Membership and routing are the libcix pool's, so there is one
+// ring for every command; everything else goes through the pool.
+//
+
+class cix_cluster {
+   private:
+      cix_pool& pool;
+      map<string,unique_ptr<client_socket>> servers;
+   public:
+      cix_cluster (cix_pool& pool): pool (pool) {}
+      void connect (const string& node) {
+         if (servers.find (node) == servers.end()) {
+            servers[node] = connect_node (node);
+         }
+      }
+      void disconnect (const string& node) { servers.erase (node); }
+      client_socket& server (const string& node) {
+         connect (node);
+         return *servers.at (node);
+      }
+      const string& owner (const string& path) const {
+         return pool.route (path);
+      }
+      const cix_ring& get_ring() const { return pool.get_ring(); }
+      const vector<string>& nodes() const { return pool.nodes(); }
+};
+
+// Run one request per argument, all at once over the pool.
+void run_each (cix_event_loop& loop, const vector<string>& params,
+               function<cix_task<void> (string)> request) {
+   for (size_t index = 1; index < params.size(); ++index) {
+      loop.spawn (request (params[index]));
+   }
+   loop.run();
+}
+
+cix_task<void> cix_put (cix_pool& pool, string filename) {
+   ifstream file (filename, ios::in | ios::binary | ios::ate);
    if (!file.is_open()) {
-      elog << params[1] << ": " << strerror(errno) << endl;
-   } else{
-      streampos size {file.tellg()};
-      char *memblock = new char [size];
-      file.seekg (0, ios::beg);
-      file.read (memblock, size);
-      file.close();
-      header.cix_command = CIX_PUT;
-      header.cix_nbytes = size;
-      strcpy(header.cix_filename, params[1].c_str());
-      elog << "sending header " << header << endl;
-      send_packet (server, &header, sizeof header);
-      send_packet (server, memblock, size);
-      recv_packet (server, &header, sizeof header);
-      elog << "received header " << header << endl;
-      if (header.cix_command != CIS_ACK)
-         elog << strerror(header.cix_nbytes) << endl;
-      else
-         elog << "put " << params[1] << " successed" << endl;
+      elog << filename << ": " << strerror(errno) << endl;
+      co_return;
+   }
+   uint64_t size = file.tellg();
+   if (size > UINT32_MAX) {
+      elog << filename << ": " << strerror (EFBIG) << endl;
+      co_return;
+   }
+   file.seekg (0, ios::beg);
+   auto copies = co_await pool.put (filename, size,
+                 [&file] (char* data, size_t nbytes) {
+      file.read (data, nbytes);
+      return size_t (file.gcount());
+   });
+   if (not copies) {
+      elog << copies.error().message << endl;
+   }else {
+      elog << "put " << filename << " successed, " << *copies
+           << " copies" << endl;
    }
 }
 
-void cix_get (client_socket& server, vector<string>& params) {
-   //if (params.size() != 2)
-   //elog << params << "missing filenames" << endl;
-   cix_header header;
-   string filename = params[1];
-   header.cix_command = CIX_GET;
-   strcpy (header.cix_filename , filename.c_str());
-   elog << "sending header " << header << endl;
-   send_packet (server, &header, sizeof header);
-   recv_packet (server, &header, sizeof header);
-   elog << "received header " << header << endl;
-   if (header.cix_command != CIX_FILE) {
-      elog << strerror(header.cix_nbytes) << endl;
+// Conditional GET against the cache:  the body only travels if the
+// server's copy differs from the cached one.
+cix_task<void> cix_get_cached (cix_pool& pool, string filename,
+                               cix_cache& cache) {
+   cix_validator validator;
+   manifest_entry cached;
+   if (cache.lookup (filename, cached)) {
+      validator.size = cached.size;
+      validator.mtime = cached.mtime;
+      validator.checksum = cached.checksum;
+   }
+   string outname = filename + ".got";
+   ofstream fileout;
+   ofstream cachefile;
+   uint64_t checksum = FNV_OFFSET_BASIS;
+   auto info = co_await pool.get_if (filename, validator,
+               [&] (const char* data, size_t nbytes) {
+      if (not fileout.is_open()) {
+         fileout.open (outname, ios::out | ios::binary);
+         cachefile = cache.open_store (filename);
+      }
+      fileout.write (data, nbytes);
+      cachefile.write (data, nbytes);
+      checksum = fnv1a_hash (data, nbytes, checksum);
+   });
+   if (not info) {
+      elog << info.error().message << endl;
+      if (cachefile.is_open()) cache.abort_store (filename);
+      co_return;
+   }
+   if (info->not_modified) {
+      cache.touch (filename, info->mtime);
+      ifstream cachedata (cache.data_path (filename), ios::binary);
+      fileout.open (outname, ios::out | ios::binary);
+      if (cached.size > 0) fileout << cachedata.rdbuf();
+      elog << "not modified, " << cached.size
+           << " bytes from cache" << endl;
+      co_return;
+   }
+   if (not fileout.is_open()) {
+      fileout.open (outname, ios::out | ios::binary);
+      cachefile = cache.open_store (filename);
+   }
+   elog << "received " << info->size << " bytes" << endl;
+   cachefile.close();
+   if (not cachefile.fail()) {
+      cache.commit_store (filename, {info->size, info->mtime, checksum});
    }else {
-      string filename {header.cix_filename};
-      //char *fileout = header.cix_filename;
-      char buffer[header.cix_nbytes + 1];
-      recv_packet (server, buffer, header.cix_nbytes); //payload
-      elog << "received " << header.cix_nbytes << " bytes" << endl;
-      filename.append(".got");
-      //ofstream fileout (filename.c_str(), ios::out || ios::binary);
-      ofstream fileout;
-      fileout.open ("crap", ios::out | ios::binary);
-      if (!fileout.is_open()) {
-         elog << "can't open: " << filename
-              << " " << strerror(errno) << endl;
-      } else{
-         fileout.write (buffer, header.cix_nbytes);
-         fileout.close();
-      }
-   }
-}
-
-void cix_rm (client_socket& server, vector<string>& params) {
+      cache.abort_store (filename);
+   }
+}
+
+// Same-host daemons pass the open file instead of a copy, so
+// their files are not cached.
+cix_task<void> cix_get (cix_pool& pool, string filename,
+                        cix_cache* cache) {
+   if (cache != nullptr and pool.route (filename).find ('/')
+                            == string::npos) {
+      co_await cix_get_cached (pool, filename, *cache);
+      co_return;
+   }
+   string outname = filename + ".got";
+   ofstream fileout;
+   auto info = co_await pool.get (filename,
+               [&] (const char* data, size_t nbytes) {
+      if (not fileout.is_open()) {
+         fileout.open (outname, ios::out | ios::binary);
+      }
+      fileout.write (data, nbytes);
+   });
+   if (not info) {
+      elog << info.error().message << endl;
+      co_return;
+   }
+   if (not fileout.is_open()) fileout.open (outname, ios::out | ios::binary);
+   if (not fileout.is_open()) {
+      elog << "can't open: " << outname << " " << strerror(errno) << endl;
+   }
+   elog << "received " << info->size << " bytes" << endl;
+}
+
+// All the names and wildcards go in one batch per daemon.
+void cix_rm (cix_event_loop& loop, cix_pool& pool,
+             const vector<string>& params) {
+   vector<string> patterns (params.begin() + 1, params.end());
+   auto removed = loop.run (pool.rm (patterns));
+   if (not removed) {
+      elog << removed.error().message << endl;
+      return;
+   }
+   for (const auto& status: removed->failed) {
+      elog << status.first << ": " << strerror (status.second) << endl;
+   }
+   elog << "removed " << removed->done << " files" << endl;
+}
+
+// cp and mv:  the daemon copies or renames, no data comes here.
+void cix_copy (cix_event_loop& loop, cix_pool& pool,
+               const vector<string>& params) {
+   if (params.size() != 3) {
+      elog << params[0] << ": source and destination required" << endl;
+      return;
+   }
+   cix_task<cix_result<void>> request = params[0] == "cp"
+                                      ? pool.copy (params[1], params[2])
+                                      : pool.move (params[1], params[2]);
+   auto done = loop.run (std::move (request));
+   if (not done) elog << done.error().message << endl;
+}
+
+// MGET the patterns, or the exact names under dirname, and write
+// the files that come back.  Failures include entries the server could not read
+// and files that could not be written here.
+bundle_result request_mget (client_socket& server,
+                            const vector<string>& patterns,
+                            bool exact,
+                            const string& dirname = ".") {
+   bundle_result result;
+   vector<bundle_status> failed;
+   {
+      bundle_writer writer (exact ? "" : ".got", dirname);
+      for (const auto& batch: batch_names (patterns)) {
+         string payload = join_lines (batch);
+         cix_header header;
+         header.cix_command = CIX_MGET;
+         header.cix_nbytes = payload.size();
+         if (exact) set_exact_names (header, dirname);
+         send_packet (server, &header, sizeof header);
+         send_packet (server, payload.c_str(), payload.size());
+         bundle_result got = recv_bundle (server, writer);
+         result.files += got.files;
+         result.bytes += got.bytes;
+         result.failed.insert (result.failed.end(), got.failed.begin(),
+                               got.failed.end());
+      }
+      failed = writer.finish();
+   }
+   result.files -= failed.size();
+   result.failed.insert (result.failed.end(), failed.begin(),
+                         failed.end());
+   return result;
+}
+
+// MPUT the files, to be stored as name.gotput or, if exact, under
+// their own names in dirname.  Failures include files that could not be read
+// here and entries the server could not store.
+bundle_result request_mput (client_socket& server,
+                            const vector<string>& filenames,
+                            bool exact,
+                            const string& dirname = ".") {
    cix_header header;
-   string filename = params[1];
-   header.cix_command = CIX_RM;
-   strcpy (header.cix_filename , filename.c_str());
-   elog << "sending header " << header << endl;
+   header.cix_command = CIX_MPUT;
+   if (exact) set_exact_names (header, dirname);
    send_packet (server, &header, sizeof header);
-   recv_packet (server, &header, sizeof header);
-   elog << "received header " << header << endl;
-   if (header.cix_command == CIS_NAK) {
-      elog << strerror(header.cix_nbytes) << endl;
+   bundle_result result = send_bundle (server, filenames, dirname);
+   for (;;) {
+      recv_packet (server, &header, sizeof header);
+      if (header.cix_command != CIS_NAK) break;
+      result.failed.push_back ({header.cix_filename,
+                                int (header.cix_nbytes)});
+   }
+   result.files = header.cix_nbytes;
+   return result;
+}
+
+void log_failures (const vector<bundle_status>& failed) {
+   for (const auto& status: failed) {
+      elog << status.filename << ": " << strerror (status.error) << endl;
    }
 }
 
-void cix_ls (client_socket& server) {
+bool has_wildcard (const string& pattern) {
+   return pattern.find_first_of ("*?[") != string::npos;
+}
+
+// Plain paths go to their owner.  Wildcards go to every daemon, and
+// a wildcard that matches nothing on some of them is not an error.
+void cix_mget (cix_cluster& cluster, vector<string>& params) {
+   map<string,vector<string>> requests;
+   for (size_t index = 1; index < params.size(); ++index) {
+      if (not has_wildcard (params[index])) {
+         requests[cluster.owner (params[index])]
+               .push_back (params[index]);
+         continue;
+      }
+      for (const auto& node: cluster.nodes()) {
+         requests[node].push_back (params[index]);
+      }
+   }
+   bool fanned_out = cluster.nodes().size() > 1;
+   bundle_result total;
+   for (const auto& request: requests) {
+      bundle_result result = request_mget (cluster.server (request.first),
+                                           request.second, false);
+      total.files += result.files;
+      total.bytes += result.bytes;
+      for (const auto& status: result.failed) {
+         if (fanned_out and status.error == ENOENT
+                        and has_wildcard (status.filename)) continue;
+         total.failed.push_back (status);
+      }
+   }
+   log_failures (total.failed);
+   elog << "received " << total.files << " files "
+        << total.bytes << " bytes" << endl;
+}
+
+void cix_mput (cix_cluster& cluster, vector<string>& params) {
+   vector<string> patterns (params.begin() + 1, params.end());
+   vector<string> filenames = expand_globs (patterns);
+   map<string,vector<string>> requests;
+   for (const auto& filename: filenames) {
+      requests[cluster.owner (filename)].push_back (filename);
+   }
+   bundle_result total;
+   for (const auto& request: requests) {
+      bundle_result result = request_mput (cluster.server (request.first),
+                                           request.second, false);
+      total.files += result.files;
+      total.bytes += result.bytes;
+      total.failed.insert (total.failed.end(), result.failed.begin(),
+                           result.failed.end());
+   }
+   log_failures (total.failed);
+   elog << "put " << total.files << " of " << filenames.size()
+        << " files, " << total.bytes << " bytes" << endl;
+}
+
+struct sync_options {
+   static constexpr size_t MAX_WORKERS = 256;
+   bool checksums {false};
+   size_t workers {4};
+   string dirname {"."};
+};
+
+// Each worker is a connection, so the count is kept to something
+// a daemon can serve.
+size_t parse_workers (const string& count, const string& source) {
+   char* end = nullptr;
+   errno = 0;
+   unsigned long workers = strtoul (count.c_str(), &end, 10);
+   if (count.size() == 0 or not isdigit (count[0]) or *end != '\0'
+       or errno != 0 or workers < 1
+       or workers > sync_options::MAX_WORKERS) {
+      throw socket_error (source + " " + count + ": workers must be 1 to "
+                          + to_string (sync_options::MAX_WORKERS));
+   }
+   return workers;
+}
+
+// [-c] [-j workers] directory
+sync_options parse_sync_options (const vector<string>& params) {
+   sync_options options;
+   char* workers = getenv ("CIX_SYNC_WORKERS");
+   if (workers != nullptr) {
+      options.workers = parse_workers (workers, "CIX_SYNC_WORKERS");
+   }
+   for (size_t index = 1; index < params.size(); ++index) {
+      if (params[index] == "-c") {
+         options.checksums = true;
+      }else if (params[index] == "-j") {
+         if (index + 1 == params.size()) {
+            throw socket_error ("usage: " + params[0]
+                                + " [-c] [-j workers] dir");
+         }
+         options.workers = parse_workers (params[++index], "-j");
+      }else {
+         options.dirname = params[index];
+      }
+   }
+   return options;
+}
+
+manifest fetch_manifest (client_socket& server, const string& dirname,
+                         bool checksums) {
    cix_header header;
-   header.cix_command = CIX_LS;
-   elog << "sending header " << header << endl;
+   header.cix_command = CIX_MANIFEST;
+   header.cix_nbytes = checksums;
+   strncpy (header.cix_filename, dirname.c_str(), CIX_FILENAME_SIZE - 1);
    send_packet (server, &header, sizeof header);
    recv_packet (server, &header, sizeof header);
-   elog << "received header " << header << endl;
    if (header.cix_command != CIX_LSOUT) {
-      elog << " sent CIX_LS, server did not return CIX_LSOUT" << endl;
-   }else {
-      char buffer[header.cix_nbytes + 1];
-      recv_packet (server, buffer, header.cix_nbytes);
-      elog << "received " << header.cix_nbytes << " bytes" << endl;
-      buffer[header.cix_nbytes] = '\0';
-      cout << buffer;
+      throw socket_error ("sent CIX_MANIFEST, server did not return "
+                          "CIX_LSOUT");
+   }
+   string text (header.cix_nbytes, '\0');
+   if (text.size() > 0) recv_packet (server, &text[0], text.size());
+   return parse_manifest (text);
+}
+
+// Deal the files out to the workers, largest first, each to the
+// worker with the fewest bytes so far.
+vector<vector<string>> partition_files (const vector<string>& filenames,
+                                        const manifest& sizes,
+                                        size_t workers) {
+   vector<string> sorted (filenames);
+   sort (sorted.begin(), sorted.end(),
+         [&sizes] (const string& left, const string& right) {
+            return sizes.at (left).size > sizes.at (right).size;
+         });
+   vector<vector<string>> parts (min (workers, sorted.size()));
+   vector<uint64_t> loads (parts.size());
+   for (const auto& filename: sorted) {
+      size_t least = min_element (loads.begin(), loads.end())
+                   - loads.begin();
+      parts[least].push_back (filename);
+      loads[least] += sizes.at (filename).size;
+   }
+   return parts;
+}
+
+// Transfer the files under dirname over a pool of connections, one
+// bundle each.
+bundle_result parallel_transfer (const string& node,
+                                 cix_command command,
+                                 const string& dirname,
+                                 const vector<string>& filenames,
+                                 const manifest& sizes, size_t workers) {
+   vector<vector<string>> parts = partition_files (filenames, sizes,
+                                                   workers);
+   vector<bundle_result> results (parts.size());
+   mutex progress;
+   size_t done = 0;
+   vector<thread> threads;
+   for (size_t index = 0; index < parts.size(); ++index) {
+      threads.emplace_back ([&, index] {
+         bundle_result& result = results[index];
+         try {
+            unique_ptr<client_socket> server = connect_node (node);
+            result = command == CIX_MGET
+                   ? request_mget (*server, parts[index], true, dirname)
+                   : request_mput (*server, parts[index], true, dirname);
+         }catch (socket_error& error) {
+            for (const auto& filename: parts[index]) {
+               result.failed.push_back ({filename, ECONNABORTED});
+            }
+            lock_guard<mutex> guard (progress);
+            elog << "worker " << index << ": " << error.what() << endl;
+         }
+         lock_guard<mutex> guard (progress);
+         elog << "worker " << index << " done, " << ++done << " of "
+              << parts.size() << ": " << result.files << " files "
+              << result.bytes << " bytes" << endl;
+      });
+   }
+   bundle_result total;
+   for (size_t index = 0; index < threads.size(); ++index) {
+      threads[index].join();
+      total.files += results[index].files;
+      total.bytes += results[index].bytes;
+      total.failed.insert (total.failed.end(),
+                           results[index].failed.begin(),
+                           results[index].failed.end());
+   }
+   return total;
+}
+
+// Paths that do not fit in a header can not be transferred.
+bool transferable (const string& filename) {
+   if (filename.size() < CIX_FILENAME_SIZE) return true;
+   elog << filename << ": " << strerror (ENAMETOOLONG) << endl;
+   return false;
+}
+
+// mirror:  make the local tree identical to the remote one,
+// removing local files that are not on the server.
+// sync:    copy in both directions, the newer file winning.
+void cix_sync (cix_cluster& cluster, vector<string>& params,
+               bool mirror) {
+   if (cluster.nodes().size() != 1) {
+      elog << params[0] << ": not supported with several servers"
+           << endl;
+      return;
+   }
+   const string& node = cluster.nodes()[0];
+   client_socket& server = cluster.server (node);
+   sync_options options = parse_sync_options (params);
+   cix_header exact; // the directory goes in each bundle header
+   if (not set_exact_names (exact, options.dirname)) {
+      elog << options.dirname << ": " << strerror (ENAMETOOLONG) << endl;
+      return;
+   }
+   auto start = chrono::steady_clock::now();
+   manifest remote = fetch_manifest (server, options.dirname,
+                                     options.checksums);
+   manifest local = build_manifest (options.dirname, options.checksums);
+   elog << options.dirname << ": " << remote.size() << " remote, "
+        << local.size() << " local files" << endl;
+   vector<string> to_get;
+   vector<string> to_put;
+   vector<string> to_remove;
+   for (const auto& file: remote) {
+      const auto& itor = local.find (file.first);
+      if (itor != local.end() and same_file (file.second, itor->second))
+         continue;
+      if (not transferable (file.first)) continue;
+      if (mirror or itor == local.end()
+                 or file.second.mtime >= itor->second.mtime) {
+         to_get.push_back (file.first);
+      }else {
+         to_put.push_back (file.first);
+      }
+   }
+   for (const auto& file: local) {
+      if (remote.find (file.first) != remote.end()) continue;
+      if (mirror) to_remove.push_back (file.first);
+      else if (transferable (file.first)) to_put.push_back (file.first);
+   }
+   elog << to_get.size() << " to get, " << to_put.size() << " to put, "
+        << to_remove.size() << " to remove, " << options.workers
+        << " workers" << endl;
+   bundle_result got = parallel_transfer (node, CIX_MGET, options.dirname,
+                                          to_get, remote, options.workers);
+   bundle_result put = parallel_transfer (node, CIX_MPUT, options.dirname,
+                                          to_put, local, options.workers);
+   size_t removed = 0;
+   for (const auto& filename: to_remove) {
+      string path = join_path (options.dirname, filename);
+      if (unlink (path.c_str()) == 0) ++removed;
+      else elog << path << ": " << strerror (errno) << endl;
+   }
+   log_failures (got.failed);
+   log_failures (put.failed);
+   double seconds = chrono::duration<double> (
+                    chrono::steady_clock::now() - start).count();
+   uint64_t bytes = got.bytes + put.bytes;
+   elog << "got " << got.files << " files, put " << put.files
+        << " files, removed " << removed << ", "
+        << got.failed.size() + put.failed.size() << " failed" << endl;
+   elog << bytes << " bytes in " << seconds << " s, "
+        << (seconds > 0 ? bytes / seconds / 1e6 : 0) << " MB/s" << endl;
+}
+
+// The file name in a line of ls -l output, after eight fields.
+string ls_name (const string& line) {
+   size_t pos = 0;
+   for (int field = 0; field < 8; ++field) {
+      pos = line.find_first_not_of (" ", pos);
+      pos = line.find (' ', pos);
+      if (pos == string::npos) return line;
    }
+   return line.substr (line.find_first_not_of (" ", pos));
 }
 
-
+// Ask every daemon at once; texts come back in node order.
+vector<string> fetch_each (cix_event_loop& loop, cix_pool& pool,
+                           cix_command command) {
+   const vector<string>& nodes = pool.nodes();
+   vector<string> texts (nodes.size());
+   for (size_t index = 0; index < nodes.size(); ++index) {
+      loop.spawn ([] (cix_pool& pool, string node, cix_command command,
+                      string& text) -> cix_task<void> {
+         auto request = command == CIX_LS ? pool.ls (node)
+                                          : pool.stats (node);
+         auto reply = co_await std::move (request);
+         if (reply) text = std::move (*reply);
+         else elog << node << ": " << reply.error().message << endl;
+      } (pool, nodes[index], command, texts[index]));
+   }
+   loop.run();
+   return texts;
+}
+
+// Buffer pool counters of our connection to each daemon.  The
+// daemon forks a cixserver per connection, so they cover only the
+// requests this session has made on it.
+void cix_stats (cix_event_loop& loop, cix_pool& pool) {
+   vector<string> texts = fetch_each (loop, pool, CIX_STATS);
+   for (size_t index = 0; index < texts.size(); ++index) {
+      cout << pool.nodes()[index] << ":" << endl << texts[index];
+   }
+}
+
+// With several daemons, merge the listings by name.
+void cix_ls (cix_event_loop& loop, cix_pool& pool) {
+   vector<string> texts = fetch_each (loop, pool, CIX_LS);
+   if (texts.size() == 1) {
+      cout << texts[0];
+      return;
+   }
+   uint64_t total = 0;
+   multimap<string,string> lines;
+   for (const auto& text: texts) {
+      istringstream listing (text);
+      string line;
+      while (getline (listing, line)) {
+         if (line.compare (0, 6, "total ") == 0) {
+            total += stoull (line.substr (6));
+         }else {
+            lines.insert ({ls_name (line), line});
+         }
+      }
+   }
+   cout << "total " << total << endl;
+   for (const auto& line: lines) cout << line.second << endl;
+}
+
+string event_name (uint8_t kind) {
+   static const vector<string> names {"lost", "create", "modify",
+                                      "delete"};
+   return kind < names.size() ? names[kind] : "?";
+}
+
+cix_task<void> cix_watch_node (cix_event_loop& loop, string node,
+                               string prefix, uint64_t since,
+                               bool show_node) {
+   auto conn = co_await cix_connection::open (loop, node);
+   if (not conn) {
+      elog << conn.error().message << endl;
+      co_return;
+   }
+   auto watched = co_await (*conn)->watch (prefix, since,
+                  [&] (const cix_event& event) {
+      if (show_node) cout << node << " ";
+      cout << event.seq << " " << event_name (event.kind) << " "
+           << event.filename << endl;
+      return true;
+   });
+   if (not watched) elog << node << ": " << watched.error().message << endl;
+}
+
+// watch [-s seq] [prefix]:  print changes as they happen, until
+// the daemons go away.  This holds the prompt:  the loop runs
+// nothing else meanwhile, so ^C is the way out.  Each daemon
+// numbers its own changes, so resuming from a seq only makes sense
+// with one of them.
+void cix_watch (cix_event_loop& loop, cix_pool& pool,
+                const vector<string>& params) {
+   static const string usage = "usage: watch [-s seq] [prefix]";
+   uint64_t since = 0;
+   string prefix;
+   for (size_t index = 1; index < params.size(); ++index) {
+      if (params[index] == "-s") {
+         if (index + 1 == params.size()) throw socket_error (usage);
+         const string& seq = params[++index];
+         char* end = nullptr;
+         errno = 0;
+         since = strtoull (seq.c_str(), &end, 10);
+         if (not isdigit (seq[0]) or *end != '\0' or errno != 0) {
+            throw socket_error (seq + ": bad seq; " + usage);
+         }
+      }else {
+         prefix = params[index];
+      }
+   }
+   for (const auto& node: pool.nodes()) {
+      loop.spawn (cix_watch_node (loop, node, prefix, since,
+                                  pool.nodes().size() > 1));
+   }
+   loop.run();
+}
+
+// Batch RM of exact names; returns the number removed.
+size_t request_mrm (client_socket& server,
+                    const vector<string>& filenames) {
+   size_t removed = 0;
+   for (const auto& batch: batch_names (filenames)) {
+      string payload = join_lines (batch);
+      cix_header header;
+      header.cix_command = CIX_MRM;
+      header.cix_nbytes = payload.size();
+      strcpy (header.cix_filename, CIX_EXACT_NAMES);
+      send_packet (server, &header, sizeof header);
+      send_packet (server, payload.c_str(), payload.size());
+      do {
+         recv_packet (server, &header, sizeof header);
+      }while (header.cix_command == CIS_NAK);
+      removed += header.cix_nbytes;
+   }
+   return removed;
+}
+
+// Move files between daemons without staging them here.  The MGET
+// reply of the source is forwarded as the body of an MPUT to the
+// destination, since both use the same bundle framing.  Files are
+// removed from the source once the destination has stored them;
+// entries the source could not read stay where they are.
+size_t relay_files (client_socket& from, client_socket& to,
+                    const vector<string>& filenames) {
+   if (filenames.empty()) return 0;
+   string payload = join_lines (filenames);
+   cix_header header;
+   header.cix_command = CIX_MGET;
+   header.cix_nbytes = payload.size();
+   strcpy (header.cix_filename, CIX_EXACT_NAMES);
+   send_packet (from, &header, sizeof header);
+   send_packet (from, payload.c_str(), payload.size());
+   header.cix_command = CIX_MPUT;
+   header.cix_nbytes = 0;
+   strcpy (header.cix_filename, CIX_EXACT_NAMES);
+   send_packet (to, &header, sizeof header);
+   set<string> not_stored;
+   io_buffer buffer;
+   do {
+      recv_packet (from, &header, sizeof header);
+      send_packet (to, &header, sizeof header);
+      if (header.cix_command == CIS_NAK) {
+         header.cix_filename[CIX_FILENAME_SIZE - 1] = '\0';
+         not_stored.insert (header.cix_filename);
+         elog << "not read: " << header.cix_filename << " "
+              << strerror (header.cix_nbytes) << endl;
+      }
+      if (header.cix_command != CIX_FILE) continue;
+      for (size_t remaining = header.cix_nbytes; remaining > 0; ) {
+         size_t nbytes = min (remaining, buffer.size());
+         recv_packet (from, buffer.data(), nbytes);
+         send_packet (to, buffer.data(), nbytes);
+         remaining -= nbytes;
+      }
+   }while (header.cix_command != CIS_ACK);
+   for (;;) {
+      recv_packet (to, &header, sizeof header);
+      if (header.cix_command != CIS_NAK) break;
+      not_stored.insert (header.cix_filename);
+      elog << "not moved: " << header.cix_filename << " "
+           << strerror (header.cix_nbytes) << endl;
+   }
+   vector<string> stored;
+   for (const auto& filename: filenames) {
+      if (not_stored.count (filename) == 0) stored.push_back (filename);
+   }
+   return request_mrm (from, stored);
+}
+
+// Only the paths whose owner changes between the two rings move,
+// so a membership change touches about 1/N of the files.  The ring
+// owns the files stored by PUT and MPUT, routed on the name the
+// client used; anything else in the daemon's directory stays.
+size_t rebalance (cix_cluster& cluster, const cix_ring& next,
+                  const vector<string>& sources) {
+   size_t moved = 0;
+   for (const auto& source: sources) {
+      manifest files = fetch_manifest (cluster.server (source), ".",
+                                       false);
+      map<string,vector<string>> moves;
+      for (const auto& file: files) {
+         string name = cix_route_name (file.first);
+         if (name == file.first) continue;
+         const string& owner = next.lookup (name);
+         if (owner == source or not transferable (file.first)) continue;
+         moves[owner].push_back (file.first);
+      }
+      for (const auto& move: moves) {
+         size_t count = 0;
+         for (const auto& batch: batch_names (move.second)) {
+            count += relay_files (cluster.server (source),
+                                  cluster.server (move.first), batch);
+         }
+         elog << "moved " << count << " of " << move.second.size()
+              << " files from " << source << " to " << move.first
+              << endl;
+         moved += count;
+      }
+   }
+   return moved;
+}
+
+void cix_join (cix_cluster& cluster, cix_pool& pool,
+               vector<string>& params) {
+   string node = split_server_list (params[1], 50000).at (0);
+   if (cluster.get_ring().contains (node)) {
+      elog << node << ": already a member" << endl;
+      return;
+   }
+   cluster.connect (node);
+   cix_ring next = cluster.get_ring();
+   next.add (node);
+   size_t moved = rebalance (cluster, next, cluster.nodes());
+   pool.add (node);
+   elog << "joined " << node << ", moved " << moved << " files" << endl;
+}
+
+void cix_leave (cix_cluster& cluster, cix_pool& pool,
+                vector<string>& params) {
+   string node = split_server_list (params[1], 50000).at (0);
+   if (not cluster.get_ring().contains (node)
+       or cluster.nodes().size() == 1) {
+      elog << node << ": not a member, or the last one" << endl;
+      return;
+   }
+   cix_ring next = cluster.get_ring();
+   next.remove (node);
+   size_t moved = rebalance (cluster, next, {node});
+   pool.remove (node);
+   cluster.disconnect (node);
+   elog << "left " << node << ", moved " << moved << " files" << endl;
+}
+
+
 unordered_map<string,cix_command> command_map {
    {"exit", CIX_EXIT},
    {"help", CIX_HELP},
@@ -144,19 +840,40 @@ unordered_map<string,cix_command> command_map {
    {"put" , CIX_PUT },
    {"get" , CIX_GET },
    {"rm"  , CIX_RM  },
+   {"cp"  , CIX_COPY},
+   {"mv"  , CIX_MOVE},
+   {"mget", CIX_MGET},
+   {"mput", CIX_MPUT},
+   {"mirror", CIX_MIRROR},
+   {"sync", CIX_SYNC},
+   {"join", CIX_JOIN},
+   {"leave", CIX_LEAVE},
+   {"stats", CIX_STATS},
+   {"watch", CIX_WATCH},
 };
 
 int main (int argc, char** argv) {
    elog.set_execname (basename (argv[0]));
    elog << "starting" << endl;
    vector<string> args (&argv[1], &argv[argc]);
-   string host = args.size() < 1 ? "localhost" : args[0];
-   in_port_t port = args.size() < 2 ? 50000 : stoi (args[1]);
+   string hosts = get_cix_server_host (args, 0);
    elog << to_string (hostinfo()) << endl;
    try {
-      elog << "connecting to " << host << " port " << port << endl;
-      client_socket server (host, port);
-      elog << "connected to " << to_string (server) << endl;
+      in_port_t port = get_cix_server_port (args, 1);
+      vector<string> nodes = split_server_list (hosts, port);
+      cix_event_loop loop;
+      cix_pool pool (loop, nodes);
+      cix_cluster cluster (pool);
+      unique_ptr<cix_cache> cache;
+      string cache_dir = get_cix_cache_dir();
+      if (cache_dir.size() > 0) {
+         string server;
+         for (const auto& node: nodes) {
+            server += (server.size() > 0 ? "," : "") + node;
+         }
+         cache.reset (new cix_cache (cache_dir, server));
+         elog << "caching in " << cache_dir << endl;
+      }
       for (;;) {
          string line;
          getline (cin, line);
@@ -178,16 +895,48 @@ int main (int argc, char** argv) {
                   cix_help();
                   break;
                case CIX_RM:
-                  cix_rm (server, params);
+                  cix_rm (loop, pool, params);
+                  break;
+               case CIX_COPY:
+               case CIX_MOVE:
+                  cix_copy (loop, pool, params);
                   break;
                case CIX_LS:
-                  cix_ls (server);
+                  cix_ls (loop, pool);
                   break;
                case CIX_GET:
-                  cix_get (server, params);
+                  run_each (loop, params, [&] (string filename) {
+                     return cix_get (pool, filename, cache.get());
+                  });
                   break;
                case CIX_PUT:
-                  cix_put (server, params);
+                  run_each (loop, params, [&pool] (string filename) {
+                     return cix_put (pool, filename);
+                  });
+                  break;
+               case CIX_MGET:
+                  cix_mget (cluster, params);
+                  break;
+               case CIX_MPUT:
+                  cix_mput (cluster, params);
+                  break;
+               case CIX_MIRROR:
+                  cix_sync (cluster, params, true);
+                  break;
+               case CIX_SYNC:
+                  cix_sync (cluster, params, false);
+                  break;
+               case CIX_JOIN:
+                  cix_join (cluster, pool, params);
+                  break;
+               case CIX_LEAVE:
+                  cix_leave (cluster, pool, params);
+                  break;
+               case CIX_STATS:
+                  cix_stats (loop, pool);
+                  break;
+               case CIX_WATCH:
+                  cix_watch (loop, pool, params);
                   break;
                default:
                   elog << line << ": invalid command" << endl;
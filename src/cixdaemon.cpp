@@ -1,23 +1,29 @@
 // $Id: cixdaemon.cpp,v 1.2 2014-05-27 23:50:13-07 - - $
 
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 using namespace std;
 
 #include <libgen.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cixjournal.h"
+#include "cixlib.h"
 #include "logstream.h"
 #include "sockets.h"
 
 logstream elog (cerr); //create an obj elog using cerr as output
 
-void fork_cixserver (server_socket& server, accepted_socket& accept) {
+using listener_list = vector<unique_ptr<server_socket>>;
+
+void fork_cixserver (listener_list& listeners, accepted_socket& accept) {
    pid_t pid = fork();
    if (pid == 0) { // child
-      server.close();
+      for (auto& listener: listeners) listener->close();
       execlp ("cixserver", "cixserver-forked",
               accept.to_string_socket_fd().c_str(), nullptr);
       // Can't get here?!
@@ -46,21 +52,128 @@ void reap_zombies() {
 }
 
 
+//
+// struct change_watch
+// the daemon's inotify watch on its directory and the journal it
+// keeps for WATCH.  Both are null if watching could not be set up.
+//
+
+struct change_watch {
+   unique_ptr<cix_journal> journal;
+   unique_ptr<cix_notifier> notifier;
+};
+
+// The journal goes outside the served directory, so writing it
+// does not show up as a change.
+change_watch make_change_watch() {
+   change_watch watch;
+   string path = get_cix_journal();
+   if (path.size() == 0) {
+      char* tmpdir = getenv ("TMPDIR");
+      path = string (tmpdir == nullptr ? "/tmp" : tmpdir)
+           + "/cixjournal." + to_string (getpid());
+   }
+   try {
+      watch.journal.reset (new cix_journal (path, true));
+      watch.notifier.reset (new cix_notifier());
+      setenv ("CIX_JOURNAL", path.c_str(), 1);
+      elog << "journal " << path << endl;
+   }catch (socket_error& error) {
+      elog << "WATCH disabled: " << error.what() << endl;
+      watch.notifier.reset();
+      watch.journal.reset();
+   }
+   return watch;
+}
+
+// Wait until one of the listeners has a pending connection,
+// journaling changes in the meantime.  A journal that can not be
+// written (ENOSPC) turns watching off rather than the daemon.  A
+// listener that fails would poll ready forever, so it is closed,
+// and the daemon gives up when none is left.
+server_socket& poll_listeners (listener_list& listeners,
+                               change_watch& watch) {
+   vector<pollfd> pollfds;
+   for (const auto& listener: listeners) {
+      pollfds.push_back ({listener->get_socket_fd(), POLLIN, 0});
+   }
+   if (watch.notifier != nullptr) {
+      pollfds.push_back ({watch.notifier->get_fd(), POLLIN, 0});
+   }
+   for (;;) {
+      int rc = poll (pollfds.data(), pollfds.size(), -1);
+      if (rc < 0 and errno != EINTR) throw socket_sys_error ("poll");
+      if (watch.notifier != nullptr and pollfds.back().revents & POLLIN) {
+         try {
+            watch.notifier->drain (*watch.journal);
+         }catch (socket_error& error) {
+            elog << "WATCH disabled: " << error.what() << endl;
+            unsetenv ("CIX_JOURNAL");
+            watch.notifier.reset();
+            watch.journal.reset();
+            pollfds.pop_back();
+         }
+      }
+      size_t index = 0;
+      while (rc > 0 and index < listeners.size()) {
+         short revents = pollfds[index].revents;
+         if (revents & POLLIN) return *listeners[index];
+         if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            elog << "closing " << to_string (*listeners[index])
+                 << ": poll revents " << revents << endl;
+            listeners.erase (listeners.begin() + index);
+            pollfds.erase (pollfds.begin() + index);
+            if (listeners.empty()) throw socket_error ("no listeners");
+         }else {
+            ++index;
+         }
+      }
+   }
+}
+
+// Listen addresses after the port:  a path containing a slash is a
+// unix domain socket, anything else is host, host:port or [v6]:port.
+// With no network address, listen on every address (dual-stack).
+listener_list make_listeners (in_port_t port,
+                              const vector<string>& addresses) {
+   listener_list listeners;
+   bool any_network = false;
+   for (const auto& address: addresses) {
+      if (address.find ('/') != string::npos) {
+         listeners.emplace_back (new server_socket (address));
+      }else {
+         auto host_port = split_host_port (address, port);
+         listeners.emplace_back (new server_socket (host_port.first,
+                                                    host_port.second));
+         any_network = true;
+      }
+   }
+   if (not any_network) {
+      listeners.emplace_back (new server_socket (port));
+   }
+   return listeners;
+}
+
 int main (int argc, char** argv) {
    elog.set_execname (basename (argv[0]));
    vector<string> args (&argv[1], &argv[argc]);
-   in_port_t port = args.size() < 1 ? 50000 : stoi (args[0]);
    try {
-      server_socket listener (port);
+      in_port_t port = args.size() < 1 ? 50000 : parse_port (args[0]);
+      vector<string> addresses;
+      if (args.size() > 1) addresses.assign (args.begin() + 1, args.end());
+      listener_list listeners = make_listeners (port, addresses);
+      elog << to_string (hostinfo()) << endl;
+      for (const auto& listener: listeners) {
+         elog << "accepting " << to_string (*listener) << endl;
+      }
+      change_watch watch = make_change_watch();
       for (;;) {
-         elog << to_string (hostinfo()) << " accepting port "
-              << to_string (port) << endl;
+         server_socket& listener = poll_listeners (listeners, watch);
          accepted_socket client_sock;
-         //this a blocking
-         listener.accept (client_sock); //waiting for a client?
+         listener.accept (client_sock);
          elog << "accepted " << to_string (client_sock) << endl;
          try {
-            fork_cixserver (listener, client_sock);
+            fork_cixserver (listeners, client_sock);
             reap_zombies();
          }catch (socket_error& error) {
             elog << error.what() << endl;
@@ -71,4 +184,3 @@ int main (int argc, char** argv) {
    }
    return 0;
 }
-
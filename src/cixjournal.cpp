@@ -0,0 +1,225 @@
+// $Id$
+
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <unordered_map>
+using namespace std;
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cixjournal.h"
+
+static constexpr uint32_t WATCH_MASK = IN_CREATE | IN_CLOSE_WRITE
+                                     | IN_DELETE | IN_MOVED_FROM
+                                     | IN_MOVED_TO;
+
+static off_t record_offset (uint64_t seq) {
+   return sizeof (uint64_t) * 2
+        + (seq % cix_journal::RECORDS) * sizeof (cix_event);
+}
+
+cix_journal::cix_journal (const string& path, bool writer):
+             path (path) {
+   int flags = writer ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;
+   fd = open (path.c_str(), flags | O_CLOEXEC, 0600);
+   if (fd < 0) throw socket_sys_error (path);
+   if (writer) {
+      head.first = head.next = uint64_t (time (nullptr)) << 20;
+      if (pwrite (fd, &head, sizeof head, 0) != sizeof head) {
+         close (fd);
+         throw socket_sys_error (path);
+      }
+   }
+}
+
+cix_journal::~cix_journal() {
+   close (fd);
+}
+
+cix_journal::journal_header cix_journal::read_header() const {
+   journal_header header;
+   if (pread (fd, &header, sizeof header, 0) != sizeof header) {
+      throw socket_sys_error (path);
+   }
+   return header;
+}
+
+uint64_t cix_journal::next_seq() const {
+   return read_header().next;
+}
+
+// The record goes in before the header that makes it visible.
+void cix_journal::append (cix_event_kind kind, const string& filename) {
+   cix_event event;
+   event.seq = head.next;
+   event.kind = kind;
+   strncpy (event.filename, filename.c_str(), CIX_FILENAME_SIZE - 1);
+   if (pwrite (fd, &event, sizeof event, record_offset (event.seq))
+       != sizeof event) {
+      throw socket_sys_error (path);
+   }
+   ++head.next;
+   if (pwrite (fd, &head, sizeof head, 0) != sizeof head) {
+      throw socket_sys_error (path);
+   }
+}
+
+bool cix_journal::read (uint64_t& seq, vector<cix_event>& events) const {
+   journal_header header = read_header();
+   uint64_t oldest = header.first;
+   if (header.next - oldest > RECORDS) oldest = header.next - RECORDS;
+   bool complete = true;
+   if (seq < oldest or seq > header.next) {
+      seq = oldest;
+      complete = false;
+   }
+   for (; seq < header.next; ++seq) {
+      cix_event event;
+      if (pread (fd, &event, sizeof event, record_offset (seq))
+          != sizeof event) {
+         throw socket_sys_error (path);
+      }
+      if (event.seq != seq) {
+         // Overwritten while we read:  we fell a whole ring behind.
+         events.clear();
+         seq = read_header().next;
+         return false;
+      }
+      events.push_back (event);
+   }
+   return complete;
+}
+
+string get_cix_journal() {
+   char* path = getenv ("CIX_JOURNAL");
+   return path == nullptr ? "" : path;
+}
+
+
+cix_notifier::cix_notifier() {
+   inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+   if (inotify_fd < 0) throw socket_sys_error ("inotify_init1");
+   watch_tree ("", nullptr);
+}
+
+cix_notifier::~cix_notifier() {
+   close (inotify_fd);
+}
+
+// Watch the directory and everything below it.  With a journal,
+// the files found are reported as created:  they appeared before
+// their directory was watched.
+void cix_notifier::watch_tree (const string& prefix,
+                               cix_journal* journal) {
+   string dirname = prefix.size() == 0 ? "." : prefix;
+   int wd = inotify_add_watch (inotify_fd, dirname.c_str(),
+                               WATCH_MASK | IN_ONLYDIR);
+   if (wd < 0) return;
+   prefixes[wd] = prefix;
+   DIR* dir = opendir (dirname.c_str());
+   if (dir == nullptr) return;
+   for (;;) {
+      dirent* entry = readdir (dir);
+      if (entry == nullptr) break;
+      string name = entry->d_name;
+      if (name == "." or name == "..") continue;
+      struct stat stat_buf;
+      if (lstat ((prefix + name).c_str(), &stat_buf) < 0) continue;
+      if (S_ISDIR (stat_buf.st_mode)) {
+         watch_tree (prefix + name + "/", journal);
+      }else if (journal != nullptr and S_ISREG (stat_buf.st_mode)
+                and prefix.size() + name.size() < CIX_FILENAME_SIZE) {
+         journal->append (CIX_EVENT_CREATE, prefix + name);
+      }
+   }
+   closedir (dir);
+}
+
+void cix_notifier::drain (cix_journal& journal) {
+   alignas (inotify_event) char buffer[0x4000];
+   for (;;) {
+      ssize_t nbytes = ::read (inotify_fd, buffer, sizeof buffer);
+      if (nbytes < 0 and errno == EINTR) continue;
+      if (nbytes <= 0) break;
+      for (char* ptr = buffer; ptr < buffer + nbytes; ) {
+         inotify_event* event = (inotify_event*) ptr;
+         ptr += sizeof (inotify_event) + event->len;
+         if (event->mask & IN_Q_OVERFLOW) {
+            journal.append (CIX_EVENT_LOST, "");
+            continue;
+         }
+         if (event->mask & IN_IGNORED) {
+            prefixes.erase (event->wd);
+            continue;
+         }
+         const auto& itor = prefixes.find (event->wd);
+         if (itor == prefixes.end() or event->len == 0) continue;
+         string filename = itor->second + event->name;
+         if (event->mask & IN_ISDIR) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+               watch_tree (filename + "/", &journal);
+            }
+            continue;
+         }
+         if (filename.size() >= CIX_FILENAME_SIZE) continue;
+         if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            journal.append (CIX_EVENT_CREATE, filename);
+         }else if (event->mask & IN_CLOSE_WRITE) {
+            journal.append (CIX_EVENT_MODIFY, filename);
+         }else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            journal.append (CIX_EVENT_DELETE, filename);
+         }
+      }
+   }
+}
+
+
+vector<cix_event> coalesce_events (const vector<cix_event>& events,
+                                   const string& prefix) {
+   struct net_change {
+      bool existed;   // before the first event
+      bool exists;    // after the last one
+      cix_event last;
+   };
+   unordered_map<string,net_change> changes;
+   vector<cix_event> lost;
+   for (const auto& event: events) {
+      if (event.kind == CIX_EVENT_LOST) {
+         lost.push_back (event);
+         continue;
+      }
+      string filename = event.filename;
+      if (filename.compare (0, prefix.size(), prefix) != 0) continue;
+      const auto& itor = changes.find (filename);
+      if (itor == changes.end()) {
+         changes[filename] = {event.kind != CIX_EVENT_CREATE,
+                              event.kind != CIX_EVENT_DELETE, event};
+      }else {
+         itor->second.exists = event.kind != CIX_EVENT_DELETE;
+         itor->second.last = event;
+      }
+   }
+   map<uint64_t,cix_event> ordered;
+   for (const auto& event: lost) ordered[event.seq] = event;
+   for (auto& change: changes) {
+      cix_event& event = change.second.last;
+      if (change.second.existed) {
+         event.kind = change.second.exists ? CIX_EVENT_MODIFY
+                                           : CIX_EVENT_DELETE;
+      }else if (change.second.exists) {
+         event.kind = CIX_EVENT_CREATE;
+      }else {
+         continue;
+      }
+      ordered[event.seq] = event;
+   }
+   vector<cix_event> result;
+   for (const auto& event: ordered) result.push_back (event.second);
+   return result;
+}
+
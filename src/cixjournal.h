@@ -0,0 +1,89 @@
+// $Id$
+
+//
+// Change journal for WATCH.
+// The daemon turns inotify events on the directory it serves into
+// numbered cix_events in a journal file.  The cixserver answering a
+// WATCH reads the journal from the client's sequence number on, so
+// the daemon does the watching once for every client.
+//
+
+#ifndef __CIXJOURNAL_H__
+#define __CIXJOURNAL_H__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cixlib.h"
+
+//
+// class cix_journal
+// a ring of the last RECORDS events after a header holding the
+// first and next sequence numbers.  A new journal starts numbering
+// from the time, so sequence numbers from an earlier run of the
+// daemon are older than anything in it.
+//
+
+class cix_journal {
+   public:
+      static constexpr uint64_t RECORDS = 0x10000;
+      // writer:  create the journal; otherwise open it to read.
+      cix_journal (const string& path, bool writer);
+      ~cix_journal();
+      const string& get_path() const { return path; }
+      uint64_t next_seq() const;
+      void append (cix_event_kind kind, const string& filename);
+      // Events from seq on, with seq moved past them.  Returns false
+      // if events after seq are no longer in the ring; the events
+      // returned then start at the oldest one kept.
+      bool read (uint64_t& seq, vector<cix_event>& events) const;
+   private:
+      struct journal_header {
+         uint64_t first {0};
+         uint64_t next {0};
+      };
+      string path;
+      int fd;
+      journal_header head;
+      cix_journal (const cix_journal&) = delete;
+      cix_journal& operator= (const cix_journal&) = delete;
+      journal_header read_header() const;
+};
+
+// The journal the daemon passes down in $CIX_JOURNAL, or "".
+string get_cix_journal();
+
+//
+// class cix_notifier
+// inotify watches on a directory tree.  Subdirectories are watched
+// as they appear, and files already in them when they do are
+// reported as created.
+//
+
+class cix_notifier {
+   private:
+      int inotify_fd;
+      map<int,string> prefixes; // watch descriptor -> "dir/"
+      void watch_tree (const string& prefix, cix_journal* journal);
+      cix_notifier (const cix_notifier&) = delete;
+      cix_notifier& operator= (const cix_notifier&) = delete;
+   public:
+      cix_notifier();  // the current directory
+      ~cix_notifier();
+      int get_fd() const { return inotify_fd; }
+      // Read the pending inotify events into the journal.
+      void drain (cix_journal& journal);
+};
+
+// The net change to each file under prefix, in journal order:
+// create then modify is a create, modify then delete a delete,
+// create then delete nothing at all.  Each keeps the seq of its
+// last event.
+vector<cix_event> coalesce_events (const vector<cix_event>& events,
+                                   const string& prefix);
+
+#endif
+
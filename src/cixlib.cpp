@@ -1,5 +1,8 @@
 // $Id: cixlib.cpp,v 1.2 2014-05-30 23:42:23-07 - - $
 
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <unordered_map>
 #include <string>
 using namespace std;
@@ -18,6 +21,24 @@ unordered_map<int,string> cix_command_map {
    {int (CIX_LSOUT), "CIX_LSOUT"},
    {int (CIS_ACK  ), "CIS_ACK"  },
    {int (CIS_NAK  ), "CIS_NAK"  },
+   {int (CIX_FILEFD), "CIX_FILEFD"},
+   {int (CIX_MGET ), "CIX_MGET" },
+   {int (CIX_MPUT ), "CIX_MPUT" },
+   {int (CIX_MTIME), "CIX_MTIME"},
+   {int (CIX_MANIFEST), "CIX_MANIFEST"},
+   {int (CIX_MIRROR), "CIX_MIRROR"},
+   {int (CIX_SYNC ), "CIX_SYNC" },
+   {int (CIX_GETIF), "CIX_GETIF"},
+   {int (CIX_NOTMOD), "CIX_NOTMOD"},
+   {int (CIX_JOIN ), "CIX_JOIN" },
+   {int (CIX_LEAVE), "CIX_LEAVE"},
+   {int (CIX_CHAIN), "CIX_CHAIN"},
+   {int (CIX_STATS), "CIX_STATS"},
+   {int (CIX_WATCH), "CIX_WATCH"},
+   {int (CIX_EVENTS), "CIX_EVENTS"},
+   {int (CIX_COPY ), "CIX_COPY" },
+   {int (CIX_MOVE ), "CIX_MOVE" },
+   {int (CIX_MRM  ), "CIX_MRM"  },
 };
 
 
@@ -43,9 +64,73 @@ void recv_packet (base_socket& socket, void* buffer, size_t bufsize) {
    }while (ntorecv > 0);
 }
 
+void send_packet_fd (base_socket& socket, int fd,
+                     const void* buffer, size_t bufsize) {
+   size_t nbytes = socket.send_fd (fd, buffer, bufsize);
+   if (nbytes < bufsize) {
+      send_packet (socket, (const char*) buffer + nbytes,
+                   bufsize - nbytes);
+   }
+}
+
+int recv_packet_fd (base_socket& socket, void* buffer, size_t bufsize) {
+   int fd = -1;
+   size_t nbytes = socket.recv_fd (fd, buffer, bufsize);
+   if (nbytes == 0) throw socket_error ("socket.recv_fd is closed");
+   if (nbytes < bufsize) {
+      recv_packet (socket, (char*) buffer + nbytes, bufsize - nbytes);
+   }
+   return fd;
+}
+
+string cix_route_name (const string& path) {
+   size_t suffix = strlen (CIX_PUT_SUFFIX);
+   if (path.size() > suffix
+       and path.compare (path.size() - suffix, suffix, CIX_PUT_SUFFIX)
+           == 0) {
+      return path.substr (0, path.size() - suffix);
+   }
+   return path;
+}
+
+bool is_exact_names (const cix_header& header) {
+   size_t length = strlen (CIX_EXACT_NAMES);
+   return strncmp (header.cix_filename, CIX_EXACT_NAMES, length) == 0
+      and (header.cix_filename[length] == '\0'
+           or header.cix_filename[length] == ':');
+}
+
+string exact_names_dir (const cix_header& header) {
+   size_t length = strlen (CIX_EXACT_NAMES);
+   if (not is_exact_names (header)
+       or header.cix_filename[length] == '\0') return ".";
+   return string (header.cix_filename + length + 1,
+                  strnlen (header.cix_filename + length + 1,
+                           CIX_FILENAME_SIZE - length - 1));
+}
+
+bool set_exact_names (cix_header& header, const string& dirname) {
+   string name = CIX_EXACT_NAMES;
+   if (dirname.size() > 0 and dirname != ".") name += ":" + dirname;
+   if (name.size() >= CIX_FILENAME_SIZE) return false;
+   memset (header.cix_filename, 0, CIX_FILENAME_SIZE);
+   strcpy (header.cix_filename, name.c_str());
+   return true;
+}
+
+string join_path (const string& dirname, const string& filename) {
+   if (dirname.size() == 0 or dirname == ".") return filename;
+   if (dirname.back() == '/') return dirname + filename;
+   return dirname + "/" + filename;
+}
+
+string cix_command_name (int command) {
+   const auto& itor = cix_command_map.find (command);
+   return itor == cix_command_map.end() ? "?" : itor->second;
+}
+
 ostream& operator<< (ostream& out, const cix_header& header) {
-   const auto& itor = cix_command_map.find (header.cix_command);
-   string code = itor == cix_command_map.end() ? "?" : itor->second;
+   string code = cix_command_name (header.cix_command);
    cout << "{" << header.cix_nbytes << "," << code << "="
         << int (header.cix_command) << ",\"" << header.cix_filename
         << "\"}";
@@ -53,6 +138,39 @@ ostream& operator<< (ostream& out, const cix_header& header) {
 }    
 
 
+in_port_t parse_port (const string& port) {
+   char* end = nullptr;
+   errno = 0;
+   unsigned long number = strtoul (port.c_str(), &end, 10);
+   if (port.size() == 0 or not isdigit (port[0]) or *end != '\0'
+       or errno != 0 or number < 1 or number > 65535) {
+      throw socket_error (port + ": invalid port");
+   }
+   return number;
+}
+
+
+pair<string,in_port_t> split_host_port (const string& address,
+                                        in_port_t default_port) {
+   if (address.size() > 0 and address[0] == '[') {
+      size_t close = address.find (']');
+      if (close == string::npos)
+         throw socket_error (address + ": missing ]");
+      string host = address.substr (1, close - 1);
+      if (close + 1 < address.size() and address[close + 1] == ':')
+         return {host, parse_port (address.substr (close + 2))};
+      return {host, default_port};
+   }
+   size_t colon = address.find (':');
+   if (colon == string::npos or address.find (':', colon + 1)
+                                != string::npos) {
+      return {address, default_port}; // no port, or bare IPv6
+   }
+   return {address.substr (0, colon),
+           parse_port (address.substr (colon + 1))};
+}
+
+
 string get_cix_server_host (const vector<string>& args, size_t index) {
    if (index < args.size()) return args[index];
    char* host = getenv ("CIX_SERVER_HOST");
@@ -63,13 +181,46 @@ string get_cix_server_host (const vector<string>& args, size_t index) {
 
 in_port_t get_cix_server_port (const vector<string>& args,
       size_t index) {
-   string port = "-1";
+   string port = "50000";
    if (index < args.size()) port = args[index];
    else {
       char* envport = getenv ("CIX_SERVER_PORT");
       if (envport != nullptr) port = envport;
    }
-   return stoi (port);
+   return parse_port (port);
+}
+
+
+vector<string> split_server_list (const string& hosts,
+                                  in_port_t default_port) {
+   vector<string> servers;
+   size_t start = 0;
+   while (start <= hosts.size()) {
+      size_t comma = hosts.find (',', start);
+      if (comma == string::npos) comma = hosts.size();
+      string address = hosts.substr (start, comma - start);
+      start = comma + 1;
+      if (address.size() == 0) continue;
+      if (address.find ('/') != string::npos) {
+         servers.push_back (address); // unix domain socket
+         continue;
+      }
+      auto host_port = split_host_port (address, default_port);
+      string host = host_port.first;
+      if (host.find (':') != string::npos) host = "[" + host + "]";
+      servers.push_back (host + ":" + to_string (host_port.second));
+   }
+   return servers;
+}
+
+
+unique_ptr<client_socket> connect_node (const string& node) {
+   if (node.find ('/') != string::npos) {
+      return unique_ptr<client_socket> (new client_socket (node));
+   }
+   auto host_port = split_host_port (node, 50000);
+   return unique_ptr<client_socket> (
+          new client_socket (host_port.first, host_port.second));
 }
 
 
@@ -6,15 +6,27 @@
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
 using namespace std;
 
 #include "sockets.h"
 
 enum cix_command {CIX_ERROR = 0, CIX_EXIT,
                   CIX_GET, CIX_HELP, CIX_LS, CIX_PUT, CIX_RM,
-                  CIX_FILE, CIX_LSOUT, CIS_ACK, CIS_NAK};
+                  CIX_FILE, CIX_LSOUT, CIS_ACK, CIS_NAK,
+                  CIX_FILEFD, CIX_MGET, CIX_MPUT,
+                  CIX_MTIME, CIX_MANIFEST,
+                  CIX_MIRROR, CIX_SYNC, CIX_GETIF, CIX_NOTMOD,
+                  CIX_JOIN, CIX_LEAVE, CIX_CHAIN, CIX_STATS,
+                  CIX_WATCH, CIX_EVENTS, CIX_COPY, CIX_MOVE,
+                  CIX_MRM};
 
 size_t constexpr CIX_FILENAME_SIZE = 59;
+// Largest list of names a request may carry, so that a client can
+// not make the server buffer whatever it likes.
+size_t constexpr CIX_MAX_NAMES_SIZE = 0x100000;
 struct cix_header {
    uint32_t cix_nbytes {0};
    uint8_t cix_command {0};
@@ -22,12 +34,90 @@ struct cix_header {
    cix_header() { memset (cix_filename, 0, CIX_FILENAME_SIZE); }
 };
 
+// PUT stores a file as name.gotput.  A path is routed to a daemon
+// on the name the client used, without the suffix.
+constexpr char CIX_PUT_SUFFIX[] = ".gotput";
+string cix_route_name (const string& path);
+
+// The filename of an MGET or MRM header that lists exact paths, as
+// taken from a manifest, rather than wildcards typed by a user.
+// An MPUT with it stores each entry under its own name, not as
+// name.gotput.  "=exact:dir" makes the names of an MGET or MPUT
+// relative to dir instead of the daemon's directory.
+constexpr char CIX_EXACT_NAMES[] = "=exact";
+bool is_exact_names (const cix_header& header);
+string exact_names_dir (const cix_header& header); // "." if none
+// False if the directory does not fit in the header.
+bool set_exact_names (cix_header& header, const string& dirname = ".");
+
+// dirname/filename, or just filename in ".".
+string join_path (const string& dirname, const string& filename);
+
+// Payload of CIX_GETIF:  the copy the client already has.
+// The reply is CIX_NOTMOD with the current mtime in cix_nbytes
+// and no payload, or CIX_MTIME followed by a normal CIX_FILE.
+struct cix_validator {
+   uint64_t size {0};
+   int64_t mtime {-1};
+   uint64_t checksum {0};
+};
+
+// Payload of CIX_EVENTS, which the server pushes after a CIX_WATCH.
+// seq numbers a daemon's changes in order; a client that reconnects
+// sends the last seq it saw to resume after it.  CIX_EVENT_LOST
+// means events were missed and the client should look again.
+enum cix_event_kind {CIX_EVENT_LOST = 0, CIX_EVENT_CREATE,
+                     CIX_EVENT_MODIFY, CIX_EVENT_DELETE};
+
+struct cix_event {
+   uint64_t seq {0};
+   uint8_t kind {CIX_EVENT_LOST};
+   char filename[CIX_FILENAME_SIZE];
+   cix_event() { memset (filename, 0, CIX_FILENAME_SIZE); }
+};
+
 void send_packet (base_socket& socket,
                   const void* buffer, size_t bufsize);
 
 void recv_packet (base_socket& socket, void* buffer, size_t bufsize);
 
+// Same as above, but also pass an open file descriptor.
+// Only works on AF_UNIX sockets.  recv_packet_fd returns -1
+// if no descriptor accompanied the packet.
+void send_packet_fd (base_socket& socket, int fd,
+                     const void* buffer, size_t bufsize);
+
+int recv_packet_fd (base_socket& socket, void* buffer, size_t bufsize);
+
+// "CIX_GET" and so on, or "?".
+string cix_command_name (int command);
+
 ostream& operator<< (ostream& out, const cix_header& header);
 
+// A decimal port number from 1 to 65535, else socket_error.
+in_port_t parse_port (const string& port);
+
+// Split "host", "host:port", "[v6addr]:port" or a bare IPv6 address.
+// The port is default_port when not given.  A bad port throws
+// socket_error.
+pair<string,in_port_t> split_host_port (const string& address,
+                                        in_port_t default_port);
+
+// Server from args[index], else $CIX_SERVER_HOST, else localhost.
+// May be a comma separated list of daemons for cluster mode.
+string get_cix_server_host (const vector<string>& args, size_t index);
+
+// Port from args[index], else $CIX_SERVER_PORT, else 50000.
+in_port_t get_cix_server_port (const vector<string>& args,
+                               size_t index);
+
+// Split a comma separated server list into "host:port" names,
+// adding the default port where one is missing.
+vector<string> split_server_list (const string& hosts,
+                                  in_port_t default_port);
+
+// Connect to a daemon named "host:port" or by its unix socket path.
+unique_ptr<client_socket> connect_node (const string& node);
+
 #endif
 
@@ -0,0 +1,112 @@
+// $Id$
+
+#include <cerrno>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cixbuffer.h"
+#include "cixmanifest.h"
+
+static constexpr int MAX_WALK_FDS = 16;
+
+uint64_t fnv1a_hash (const void* data, size_t size, uint64_t hash) {
+   const unsigned char* bytes = (const unsigned char*) data;
+   for (size_t index = 0; index < size; ++index) {
+      hash ^= bytes[index];
+      hash *= 0x100000001b3ULL;
+   }
+   return hash;
+}
+
+bool file_checksum (const string& filename, uint64_t& checksum) {
+   int fd = open (filename.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) return false;
+   posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+   io_buffer buffer;
+   uint64_t hash = FNV_OFFSET_BASIS;
+   for (;;) {
+      ssize_t nbytes = read (fd, buffer.data(), buffer.size());
+      if (nbytes < 0) {
+         close (fd);
+         return false;
+      }
+      if (nbytes == 0) break;
+      hash = fnv1a_hash (buffer.data(), nbytes, hash);
+   }
+   close (fd);
+   checksum = hash;
+   return true;
+}
+
+// nftw takes no user argument, so the walk collects into statics.
+static manifest* walk_files = nullptr;
+static size_t walk_prefix = 0; // length of "dirname/"
+
+static int walk_entry (const char* path, const struct stat* stat_buf,
+                       int type, FTW* ftw) {
+   if (type != FTW_F or not S_ISREG (stat_buf->st_mode)) return 0;
+   if (ftw->level == 0) return 0; // dirname is not a directory
+   manifest_entry& entry = (*walk_files)[path + walk_prefix];
+   entry.size = stat_buf->st_size;
+   entry.mtime = stat_buf->st_mtime;
+   return 0;
+}
+
+manifest build_manifest (const string& dirname, bool checksums) {
+   manifest files;
+   string root = dirname;
+   while (root.size() > 1 and root.back() == '/') root.pop_back();
+   walk_files = &files;
+   if (root != "/") root += "/";
+   walk_prefix = root.size();
+   nftw (root.c_str(), walk_entry, MAX_WALK_FDS, FTW_PHYS);
+   walk_files = nullptr;
+   if (checksums) {
+      for (auto& file: files) {
+         file_checksum (root + file.first, file.second.checksum);
+      }
+   }
+   return files;
+}
+
+string format_manifest (const manifest& files) {
+   ostringstream text;
+   for (const auto& file: files) {
+      text << file.second.size << " " << file.second.mtime << " "
+           << hex << file.second.checksum << dec << " "
+           << file.first << "\n";
+   }
+   return text.str();
+}
+
+manifest parse_manifest (const string& text) {
+   manifest files;
+   istringstream lines (text);
+   string line;
+   while (getline (lines, line)) {
+      istringstream fields (line);
+      manifest_entry entry;
+      fields >> entry.size >> entry.mtime >> hex >> entry.checksum >> dec;
+      fields.get(); // the single blank before the path
+      string filename;
+      getline (fields, filename);
+      if (fields.fail() or filename.size() == 0) continue;
+      files[filename] = entry;
+   }
+   return files;
+}
+
+bool same_file (const manifest_entry& left, const manifest_entry& right) {
+   if (left.size != right.size) return false;
+   if (left.checksum != 0 and right.checksum != 0) {
+      return left.checksum == right.checksum;
+   }
+   return left.mtime == right.mtime;
+}
@@ -0,0 +1,47 @@
+// $Id$
+
+//
+// Directory manifests for SYNC and MIRROR.
+// A manifest lists every regular file below a directory with its
+// size, modification time and optionally a content checksum.  It
+// travels as text, one "size mtime checksum path" line per file.
+//
+
+#ifndef __CIXMANIFEST_H__
+#define __CIXMANIFEST_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+using namespace std;
+
+struct manifest_entry {
+   uint64_t size {0};
+   int64_t mtime {0};
+   uint64_t checksum {0}; // 0 when not computed
+};
+
+using manifest = map<string,manifest_entry>;
+
+// Walk the tree under dirname.  Paths in the manifest are relative
+// to dirname, so each host joins them to its own copy of the tree.
+manifest build_manifest (const string& dirname, bool checksums);
+
+string format_manifest (const manifest& files);
+manifest parse_manifest (const string& text);
+
+// 64-bit FNV-1a, continuing from hash.
+uint64_t constexpr FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+uint64_t fnv1a_hash (const void* data, size_t size,
+                     uint64_t hash = FNV_OFFSET_BASIS);
+
+// 64-bit FNV-1a of the file contents.  Returns false if the file
+// can not be read.
+bool file_checksum (const string& filename, uint64_t& checksum);
+
+// Same contents, judged by checksum when both sides have one.
+bool same_file (const manifest_entry& left, const manifest_entry& right);
+
+#endif
+
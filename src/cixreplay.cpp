@@ -0,0 +1,396 @@
+// $Id$
+
+//
+// cixreplay
+// replays cixserver traces ($CIX_TRACE) against a daemon and shows
+// the latency of each command.  Every trace file is one connection
+// and is replayed on one, with the requests spaced as they were,
+// divided by the speed; at speed 0 each request goes as soon as the
+// one before it on its connection is answered.  File contents are
+// synthetic, of the traced sizes, and the files the trace read are
+// made on the daemon before the clock starts.  With -b the trace is
+// first replayed against a baseline daemon, and the two compared,
+// to measure one build against another; both are warmed up with an
+// untimed pass before either is timed.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <libgen.h>
+
+#include "cixlib.h"
+#include "cixtrace.h"
+#include "libcix.h"
+#include "logstream.h"
+
+logstream elog (cerr);
+
+using replay_clock = chrono::steady_clock;
+
+// Latencies in milliseconds, by command.
+using latency_map = map<string,vector<double>>;
+
+struct replay_run {
+   string name;
+   latency_map latencies;
+   size_t sent {0};
+   size_t failed {0};    // answered with an error
+   size_t skipped {0};   // commands cixreplay does not send
+   size_t lost {0};      // not sent after the connection broke
+   double seconds {0};
+};
+
+// The files the traced requests found, and their sizes.
+// Conditional GETs that were not modified get a validator that
+// matches the file made for them, once it is made.
+struct replay_plan {
+   map<string,uint64_t> files;
+   set<string> unchanged;
+   map<string,cix_validator> validators;
+};
+
+bool replayable (uint8_t command) {
+   switch (command) {
+      case CIX_GET: case CIX_GETIF: case CIX_PUT:
+      case CIX_RM: case CIX_LS: case CIX_STATS:
+         return true;
+      default:
+         return false;
+   }
+}
+
+string traced_filename (const cix_trace_record& record) {
+   return string (record.cix_filename,
+                  strnlen (record.cix_filename, CIX_FILENAME_SIZE));
+}
+
+replay_plan make_plan (const vector<vector<cix_trace_record>>& traces) {
+   replay_plan plan;
+   for (const auto& trace: traces) {
+      for (const auto& record: trace) {
+         string filename = traced_filename (record);
+         switch (record.cix_command) {
+            case CIX_GET: case CIX_GETIF:
+               if (record.reply_command == CIX_FILE
+                   or record.reply_command == CIX_FILEFD) {
+                  plan.files[filename] = record.reply_nbytes;
+               }else if (record.reply_command == CIX_NOTMOD) {
+                  plan.files.emplace (filename, 0);
+                  plan.unchanged.insert (filename);
+               }
+               break;
+            case CIX_RM:
+               if (record.reply_command == CIS_ACK) {
+                  plan.files.emplace (filename, 0);
+               }
+               break;
+         }
+      }
+   }
+   return plan;
+}
+
+template <typename T>
+cix_result<void> status (const cix_result<T>& result) {
+   if (result) return {};
+   return result.error();
+}
+
+// Only the size of a synthetic file matters.
+size_t synthetic_data (char* data, size_t nbytes) {
+   memset (data, 'x', nbytes);
+   return nbytes;
+}
+
+void discard_data (const char*, size_t) {
+}
+
+// A PUT is stored as name.gotput, so each file is put under its
+// name and then moved into place.
+cix_task<cix_result<void>> prepare (cix_event_loop& loop, string node,
+                                    replay_plan& plan) {
+   auto conn = co_await cix_connection::open (loop, node);
+   if (not conn) co_return conn.error();
+   plan.validators.clear();
+   for (const auto& file: plan.files) {
+      auto put = co_await (*conn)->put (file.first, file.second,
+                                        synthetic_data);
+      if (not put) co_return put.error();
+      auto moved = co_await (*conn)->move (file.first + ".gotput",
+                                           file.first);
+      if (not moved) co_return moved.error();
+      if (plan.unchanged.count (file.first) == 0) continue;
+      auto info = co_await (*conn)->get_if (file.first, {},
+                                            discard_data);
+      if (not info) co_return info.error();
+      cix_validator& validator = plan.validators[file.first];
+      validator.size = info->size;
+      validator.mtime = info->mtime;
+   }
+   co_return cix_result<void>();
+}
+
+cix_task<cix_result<void>> replay_request (
+               cix_connection& conn, const cix_trace_record& record,
+               const replay_plan& plan) {
+   string filename = traced_filename (record);
+   switch (record.cix_command) {
+      case CIX_GET: {
+         auto got = co_await conn.get (filename, discard_data);
+         co_return status (got);
+      }
+      case CIX_GETIF: {
+         cix_validator validator;
+         const auto& itor = plan.validators.find (filename);
+         if (record.reply_command == CIX_NOTMOD
+             and itor != plan.validators.end()) {
+            validator = itor->second;
+         }
+         auto got = co_await conn.get_if (filename, validator,
+                                          discard_data);
+         co_return status (got);
+      }
+      case CIX_PUT: {
+         auto put = co_await conn.put (filename, record.cix_nbytes,
+                                       synthetic_data);
+         co_return status (put);
+      }
+      case CIX_RM:
+         co_return co_await conn.rm (filename);
+      case CIX_LS: {
+         auto text = co_await conn.ls();
+         co_return status (text);
+      }
+      case CIX_STATS: {
+         auto text = co_await conn.stats();
+         co_return status (text);
+      }
+   }
+   co_return cix_error {cix_errc::invalid, 0, "not replayable"};
+}
+
+cix_task<void> replay_connection (cix_event_loop& loop, string node,
+                                  const vector<cix_trace_record>& trace,
+                                  const replay_plan& plan,
+                                  replay_clock::time_point origin,
+                                  int64_t first_ns, double speed,
+                                  replay_run& run) {
+   size_t index = 0;
+   auto conn = co_await cix_connection::open (loop, node);
+   if (not conn) {
+      elog << conn.error().message << endl;
+      index = trace.size();
+      for (const auto& record: trace) {
+         if (replayable (record.cix_command)) ++run.lost;
+      }
+   }
+   for (; index < trace.size(); ++index) {
+      const cix_trace_record& record = trace[index];
+      if (not replayable (record.cix_command)) {
+         ++run.skipped;
+         continue;
+      }
+      if (speed > 0) {
+         chrono::nanoseconds offset (
+                  int64_t ((record.start_ns - first_ns) / speed));
+         co_await loop.sleep_until (origin + offset);
+      }
+      auto start = replay_clock::now();
+      auto result = co_await replay_request (**conn, record, plan);
+      chrono::duration<double,milli> took = replay_clock::now() - start;
+      ++run.sent;
+      if (result) {
+         run.latencies[cix_command_name (record.cix_command)]
+            .push_back (took.count());
+         continue;
+      }
+      ++run.failed;
+      if (result.error().code == cix_errc::remote) continue;
+      elog << result.error().message << endl;
+      ++index;
+      break;
+   }
+   for (; index < trace.size(); ++index) {
+      if (replayable (trace[index].cix_command)) ++run.lost;
+   }
+}
+
+replay_run replay (const string& node,
+                   const vector<vector<cix_trace_record>>& traces,
+                   replay_plan& plan, double speed) {
+   replay_run run;
+   run.name = node;
+   cix_event_loop loop;
+   auto prepared = loop.run (prepare (loop, node, plan));
+   if (not prepared) {
+      throw socket_error (prepared.error().message);
+   }
+   int64_t first_ns = INT64_MAX;
+   for (const auto& trace: traces) {
+      if (trace.size() > 0) first_ns = min (first_ns, trace[0].start_ns);
+   }
+   auto origin = replay_clock::now();
+   for (const auto& trace: traces) {
+      loop.spawn (replay_connection (loop, node, trace, plan, origin,
+                                     first_ns, speed, run));
+   }
+   loop.run();
+   chrono::duration<double> took = replay_clock::now() - origin;
+   run.seconds = took.count();
+   return run;
+}
+
+// What the trace itself recorded, for the commands a replay sends.
+// Only shown beside the replays:  the traced daemon ran on another
+// machine and load, so its timings are no baseline.
+replay_run traced_run (const vector<vector<cix_trace_record>>& traces) {
+   replay_run run;
+   run.name = "trace";
+   int64_t first_ns = INT64_MAX;
+   int64_t last_ns = INT64_MIN;
+   for (const auto& trace: traces) {
+      for (const auto& record: trace) {
+         if (not replayable (record.cix_command)) continue;
+         run.latencies[cix_command_name (record.cix_command)]
+            .push_back (record.duration_ns / 1e6);
+         ++run.sent;
+         first_ns = min (first_ns, record.start_ns);
+         last_ns = max<int64_t> (last_ns,
+                                 record.start_ns + record.duration_ns);
+      }
+   }
+   if (run.sent > 0) run.seconds = (last_ns - first_ns) / 1e9;
+   return run;
+}
+
+// Nearest rank percentile of sorted latencies.
+double percentile (const vector<double>& sorted, double fraction) {
+   size_t rank = ceil (fraction * sorted.size());
+   return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void sort_latencies (replay_run& run) {
+   for (auto& command: run.latencies) {
+      sort (command.second.begin(), command.second.end());
+   }
+}
+
+void report (const replay_run& run) {
+   cout << run.name << ": " << run.sent << " requests in " << fixed
+        << setprecision (3) << run.seconds << " s";
+   if (run.failed > 0) cout << ", " << run.failed << " failed";
+   if (run.skipped > 0) cout << ", " << run.skipped << " skipped";
+   if (run.lost > 0) cout << ", " << run.lost << " not sent";
+   cout << endl;
+   cout << "   " << left << setw (14) << "command" << right
+        << setw (8) << "count" << setw (10) << "p50 ms"
+        << setw (10) << "p90 ms" << setw (10) << "p99 ms"
+        << setw (10) << "max ms" << endl;
+   for (const auto& command: run.latencies) {
+      const vector<double>& sorted = command.second;
+      cout << "   " << left << setw (14) << command.first << right
+           << setw (8) << sorted.size()
+           << setw (10) << percentile (sorted, 0.50)
+           << setw (10) << percentile (sorted, 0.90)
+           << setw (10) << percentile (sorted, 0.99)
+           << setw (10) << sorted.back() << endl;
+   }
+}
+
+string change (double before, double after) {
+   if (before <= 0) return "-";
+   ostringstream text;
+   text << showpos << fixed << setprecision (1)
+        << (after - before) / before * 100 << "%";
+   return text.str();
+}
+
+void compare (const replay_run& baseline, const replay_run& target) {
+   cout << target.name << " against " << baseline.name << endl;
+   cout << "   " << left << setw (14) << "command" << right
+        << setw (10) << "p50" << setw (10) << "p90"
+        << setw (10) << "p99" << setw (10) << "max" << endl;
+   for (const auto& command: target.latencies) {
+      const auto& itor = baseline.latencies.find (command.first);
+      if (itor == baseline.latencies.end()) continue;
+      const vector<double>& before = itor->second;
+      const vector<double>& after = command.second;
+      cout << "   " << left << setw (14) << command.first << right
+           << setw (10) << change (percentile (before, 0.50),
+                                   percentile (after, 0.50))
+           << setw (10) << change (percentile (before, 0.90),
+                                   percentile (after, 0.90))
+           << setw (10) << change (percentile (before, 0.99),
+                                   percentile (after, 0.99))
+           << setw (10) << change (before.back(), after.back()) << endl;
+   }
+}
+
+int main (int argc, char** argv) {
+   elog.set_execname (basename (argv[0]));
+   vector<string> args (&argv[1], &argv[argc]);
+   double speed = 1;
+   string baseline;
+   size_t index = 0;
+   try {
+      for (; index + 1 < args.size() and args[index][0] == '-';
+           index += 2) {
+         if (args[index] == "-s") speed = stod (args[index + 1]);
+         else if (args[index] == "-b") baseline = args[index + 1];
+         else throw invalid_argument (args[index]);
+      }
+      if (args.size() < index + 2 or speed < 0) {
+         throw invalid_argument ("missing arguments");
+      }
+   }catch (logic_error&) {
+      elog << "usage: " << basename (argv[0])
+           << " [-s speed] [-b baseline] server trace..." << endl;
+      return 1;
+   }
+   try {
+      in_port_t port = get_cix_server_port ({}, 0);
+      string server = split_server_list (args[index], port).at (0);
+      vector<vector<cix_trace_record>> traces;
+      for (++index; index < args.size(); ++index) {
+         traces.push_back (read_trace (args[index]));
+      }
+      replay_plan plan = make_plan (traces);
+      replay_run recorded = traced_run (traces);
+      sort_latencies (recorded);
+      report (recorded);
+      replay_run before;
+      if (baseline.size() > 0) {
+         // An untimed pass over each daemon first, so that neither
+         // is timed with cold caches and the other warm.
+         baseline = split_server_list (baseline, port).at (0);
+         replay (baseline, traces, plan, 0);
+         replay (server, traces, plan, 0);
+         before = replay (baseline, traces, plan, speed);
+         sort_latencies (before);
+         report (before);
+      }
+      replay_run after = replay (server, traces, plan, speed);
+      sort_latencies (after);
+      report (after);
+      if (baseline.size() > 0) compare (before, after);
+   }catch (socket_error& error) {
+      elog << error.what() << endl;
+      return 1;
+   }catch (out_of_range&) {
+      elog << "no server given" << endl;
+      return 1;
+   }
+   return 0;
+}
+
@@ -0,0 +1,49 @@
+// $Id$
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+#include "cixmanifest.h"
+#include "cixring.h"
+
+// FNV-1a alone clusters similar strings such as "host:1#1" and
+// "host:1#2", so finish with the splitmix64 mixer.
+static uint64_t ring_hash (const string& key) {
+   uint64_t hash = fnv1a_hash (key.c_str(), key.size());
+   hash ^= hash >> 30;
+   hash *= 0xbf58476d1ce4e5b9ULL;
+   hash ^= hash >> 27;
+   hash *= 0x94d049bb133111ebULL;
+   hash ^= hash >> 31;
+   return hash;
+}
+
+void cix_ring::add (const string& node) {
+   if (contains (node)) return;
+   members.push_back (node);
+   for (size_t vnode = 0; vnode < vnodes; ++vnode) {
+      points[ring_hash (node + "#" + to_string (vnode))] = node;
+   }
+}
+
+void cix_ring::remove (const string& node) {
+   members.erase (std::remove (members.begin(), members.end(), node),
+                  members.end());
+   for (auto itor = points.begin(); itor != points.end(); ) {
+      if (itor->second == node) itor = points.erase (itor);
+                           else ++itor;
+   }
+}
+
+const string& cix_ring::lookup (const string& path) const {
+   if (points.empty()) throw runtime_error ("cix_ring: no nodes");
+   auto itor = points.lower_bound (ring_hash (path));
+   if (itor == points.end()) itor = points.begin();
+   return itor->second;
+}
+
+bool cix_ring::contains (const string& node) const {
+   return find (members.begin(), members.end(), node) != members.end();
+}
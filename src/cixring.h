@@ -0,0 +1,38 @@
+// $Id$
+
+//
+// class cix_ring
+// consistent hash ring for spreading paths over several daemons.
+// Each node is placed at vnodes points on the ring and a path
+// belongs to the first node point at or after the hash of the
+// path.  Adding or removing a node only moves the paths that hash
+// next to its points, about 1/N of them.
+//
+
+#ifndef __CIXRING_H__
+#define __CIXRING_H__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+class cix_ring {
+   private:
+      static constexpr size_t DEFAULT_VNODES = 64;
+      size_t vnodes;
+      map<uint64_t,string> points;
+      vector<string> members;
+   public:
+      explicit cix_ring (size_t vnodes = DEFAULT_VNODES):
+               vnodes (vnodes) {}
+      void add (const string& node);
+      void remove (const string& node);
+      const string& lookup (const string& path) const;
+      const vector<string>& nodes() const { return members; }
+      bool contains (const string& node) const;
+};
+
+#endif
+
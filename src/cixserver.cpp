@@ -2,14 +2,29 @@
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <vector>
 #include <unistd.h>
+#include <cctype>
 #include <cerrno>
+#include <cstdlib>
 using namespace std;
 
+#include <fcntl.h>
 #include <libgen.h>
+#include <linux/fs.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 
+#include "cixbuffer.h"
+#include "cixbundle.h"
+#include "cixjournal.h"
 #include "cixlib.h"
+#include "cixmanifest.h"
+#include "cixtrace.h"
 #include "logstream.h"
 #include "sockets.h"
 
@@ -30,28 +45,202 @@ void reply_rm (accepted_socket& client_sock, cix_header& header) {
    }
 }
 
-void reply_put (accepted_socket& client_sock, cix_header& header) {
+//
+// Chain replication of PUT.  The primary forwards each chunk down
+// the chain of replicas as it arrives, so the copies are written
+// in parallel instead of store and forward.  A CIX_CHAIN header
+// ahead of the forwarded CIX_PUT tells each replica the rest of
+// the chain.  Replies travel back up, each ACK carrying the number
+// of copies stored at and below that daemon.
+//
+
+struct replication {
+   vector<string> chain; // replicas after this daemon
+   size_t acks {1};      // copies needed before the client is ACKed
+   bool primary {true};
+};
+
+// The primary's chain is $CIX_REPLICAS, a list of host:port.
+// $CIX_REPLICA_ACKS defaults to every copy.  More acks than there
+// are copies could never be met and would NAK every PUT, so a
+// count that is not from 1 to the copies is logged and ignored.
+replication get_replication() {
+   replication repl;
+   char* replicas = getenv ("CIX_REPLICAS");
+   if (replicas != nullptr) repl.chain = split_server_list (replicas,
+                                                             50000);
+   repl.acks = repl.chain.size() + 1;
+   char* acks = getenv ("CIX_REPLICA_ACKS");
+   if (acks != nullptr) {
+      char* end = nullptr;
+      errno = 0;
+      unsigned long count = strtoul (acks, &end, 10);
+      if (isdigit (acks[0]) and *end == '\0' and errno == 0
+          and count >= 1 and count <= repl.acks) {
+         repl.acks = count;
+      }else {
+         elog << "CIX_REPLICA_ACKS=" << acks << ": not from 1 to "
+              << repl.acks << ", using " << repl.acks << endl;
+      }
+   }
+   return repl;
+}
+
+replication recv_chain (accepted_socket& client_sock,
+                        cix_header& header, cix_arena& arena) {
+   if (header.cix_nbytes > CIX_MAX_NAMES_SIZE) {
+      throw socket_error ("CIX_CHAIN: payload too large");
+   }
+   char* replicas = (char*) arena.allocate (header.cix_nbytes);
+   if (header.cix_nbytes > 0) {
+      recv_packet (client_sock, replicas, header.cix_nbytes);
+   }
+   replication repl;
+   repl.chain = split_server_list (string (replicas, header.cix_nbytes),
+                                   50000);
+   repl.primary = false;
+   return repl;
+}
+
+// Connect to the next replica and pass on the rest of the chain.
+unique_ptr<client_socket> open_downstream (const replication& repl,
+                                           const cix_header& header) {
+   if (repl.chain.empty()) return nullptr;
+   try {
+      unique_ptr<client_socket> downstream = connect_node (repl.chain[0]);
+      string rest;
+      for (size_t index = 1; index < repl.chain.size(); ++index) {
+         rest += (rest.size() > 0 ? "," : "") + repl.chain[index];
+      }
+      cix_header chain_header;
+      chain_header.cix_command = CIX_CHAIN;
+      chain_header.cix_nbytes = rest.size();
+      send_packet (*downstream, &chain_header, sizeof chain_header);
+      send_packet (*downstream, rest.c_str(), rest.size());
+      send_packet (*downstream, &header, sizeof header);
+      return downstream;
+   }catch (socket_error& error) {
+      elog << "replica " << repl.chain[0] << ": " << error.what() << endl;
+      return nullptr;
+   }
+}
+
+// Copies stored at and below the downstream replica.
+size_t recv_downstream_ack (unique_ptr<client_socket>& downstream) {
+   if (downstream == nullptr) return 0;
+   try {
+      cix_header header;
+      recv_packet (*downstream, &header, sizeof header);
+      elog << "replica replied " << header << endl;
+      return header.cix_command == CIS_ACK ? header.cix_nbytes : 0;
+   }catch (socket_error& error) {
+      elog << "replica: " << error.what() << endl;
+      return 0;
+   }
+}
+
+void send_put_reply (accepted_socket& client_sock, cix_header& header,
+                     size_t copies, int error) {
+   if (error == 0) {
+      header.cix_nbytes = copies;
+      header.cix_command = CIS_ACK;
+      elog << "sending ACK header " << header << endl;
+   }else {
+      header.cix_nbytes = error;
+      header.cix_command = CIS_NAK;
+      elog << "sending NAK header " << header << endl;
+   }
+   send_packet (client_sock, &header, sizeof header);
+}
+
+void reply_put (accepted_socket& client_sock, cix_header& header,
+                const replication& repl) {
    string filename {header.cix_filename};
    uint32_t size {header.cix_nbytes};
-   char buffer[size + 1];
-   filename.append(".gotput");
-   recv_packet (client_sock, buffer, size);
+   filename.append (CIX_PUT_SUFFIX);
+   // Written beside the file and renamed over it once complete, so
+   // an upload cut off part way never replaces the file.
+   string temp = filename + ".cixput." + to_string (getpid());
+   unique_ptr<client_socket> downstream = open_downstream (repl, header);
+   make_parent_dirs (temp);
    ofstream fileout;
-   fileout.open (filename, ios::out | ios::binary);
+   fileout.open (temp, ios::out | ios::binary);
+   int error = 0;
    if (!fileout.is_open()){
-      elog << "can't open: " << filename
+      error = errno;
+      elog << "can't open: " << temp
          << " " << strerror(errno) << endl;
-   } else {
-      fileout.write (buffer, size);
+   }
+   io_buffer buffer;
+   try {
+      for (uint32_t remaining = size; remaining > 0; ) {
+         size_t nbytes = min<size_t> (remaining, buffer.size());
+         recv_packet (client_sock, buffer.data(), nbytes);
+         if (downstream != nullptr) {
+            try {
+               send_packet (*downstream, buffer.data(), nbytes);
+            }catch (socket_error& replica_error) {
+               elog << "replica: " << replica_error.what() << endl;
+               downstream.reset();
+            }
+         }
+         if (error == 0) fileout.write (buffer.data(), nbytes);
+         remaining -= nbytes;
+      }
+   }catch (socket_error&) {
       fileout.close();
-      header.cix_nbytes = 0;
-      header.cix_command = CIS_ACK;
-      elog << "sending ACK header " << header << endl;
+      unlink (temp.c_str());
+      throw;
+   }
+   if (error == 0) {
+      fileout.close();
+      if (fileout.fail()) error = EIO;
+      if (error == 0 and rename (temp.c_str(), filename.c_str()) < 0) {
+         error = errno;
+      }
+      if (error != 0) unlink (temp.c_str());
+   }
+   size_t copies = error == 0 ? 1 : 0;
+   // Only the primary can ACK before the replicas are done, and
+   // only if its own copy is enough.
+   bool replied = false;
+   if (repl.primary and copies >= repl.acks) {
+      send_put_reply (client_sock, header, copies, 0);
+      replied = true;
+   }
+   copies += recv_downstream_ack (downstream);
+   elog << filename << ": " << copies << " copies" << endl;
+   if (replied) return;
+   if (error == 0 and copies < repl.acks) error = EIO;
+   send_put_reply (client_sock, header, copies, error);
+}
+
+// Same-host client on a unix domain socket:  pass the opened file
+// instead of copying its contents through the socket.
+void reply_get_fd (accepted_socket& client_sock, cix_header& header) {
+   int fd = open (header.cix_filename, O_RDONLY | O_CLOEXEC);
+   struct stat stat_buf;
+   if (fd < 0 or fstat (fd, &stat_buf) < 0) {
+      elog << header.cix_filename << ": " << strerror(errno) << endl; 
+      header.cix_nbytes = errno;
+      header.cix_command = CIS_NAK;
+      if (fd >= 0) close (fd);
+      elog << "sending NAK header " << header << endl;
       send_packet (client_sock, &header, sizeof header);
+   } else{
+      header.cix_command = CIX_FILEFD;
+      header.cix_nbytes = stat_buf.st_size;
+      elog << "sending header with fd " << header << endl;
+      send_packet_fd (client_sock, fd, &header, sizeof header);
+      close (fd);
    }
 }
 
 void reply_get (accepted_socket& client_sock, cix_header& header) {
+   if (client_sock.is_local()) {
+      reply_get_fd (client_sock, header);
+      return;
+   }
    ifstream file(header.cix_filename, ios::in|ios::binary|ios::ate); 
    if (!file.is_open()) {
       elog << header.cix_filename << ": " << strerror(errno) << endl; 
@@ -61,17 +250,26 @@ void reply_get (accepted_socket& client_sock, cix_header& header) {
       send_packet (client_sock, &header, sizeof header);
    } else{ 
       streampos size {file.tellg()};
-      char *memblock = new char [size];
       file.seekg (0, ios::beg);
-      file.read (memblock, size);
-      file.close();
       header.cix_command = CIX_FILE;
       header.cix_nbytes = size;
       elog << "sending header " << header << endl;
       send_packet (client_sock, &header, sizeof header);
-      send_packet (client_sock, memblock, size);
+      io_buffer buffer;
+      for (size_t remaining = size; remaining > 0; ) {
+         size_t nbytes = min (remaining, buffer.size());
+         file.read (buffer.data(), nbytes);
+         // The size is promised, and the rest of the buffer holds
+         // whatever an earlier request left there.
+         if (size_t (file.gcount()) != nbytes) {
+            throw socket_error (string (header.cix_filename)
+                                + ": file shrank while being sent");
+         }
+         send_packet (client_sock, buffer.data(), nbytes);
+         remaining -= nbytes;
+      }
+      file.close();
       elog << "sent " << size << " bytes" << endl;
-      delete[] memblock;
    }
 }
 
@@ -79,20 +277,358 @@ void reply_get (accepted_socket& client_sock, cix_header& header) {
 void reply_ls (accepted_socket& client_sock, cix_header& header) {
    FILE* ls_pipe = popen ("ls -l", "r");
    if (ls_pipe == NULL) throw socket_sys_error ("popen(\"ls -l\")");
-   string ls_output;
-   char buffer[0x1000];
+   // Fill pooled buffers one after another; nothing is copied
+   // or reallocated as the listing grows.
+   vector<io_buffer> chunks;
+   size_t ls_size = 0;
    for (;;) {
-      char* rc = fgets (buffer, sizeof buffer, ls_pipe);
-      if (rc == nullptr) break;
-      ls_output.append (buffer);
+      size_t used = ls_size % io_buffer::size();
+      if (used == 0) chunks.emplace_back();
+      size_t nbytes = fread (chunks.back().data() + used, 1,
+                             io_buffer::size() - used, ls_pipe);
+      if (nbytes == 0) break;
+      ls_size += nbytes;
    }
+   pclose (ls_pipe);
    header.cix_command = CIX_LSOUT;
-   header.cix_nbytes = ls_output.size();
+   header.cix_nbytes = ls_size;
    memset (header.cix_filename, 0, CIX_FILENAME_SIZE);
    elog << "sending header " << header << endl;
    send_packet (client_sock, &header, sizeof header);
-   send_packet (client_sock, ls_output.c_str(), ls_output.size());
-   elog << "sent " << ls_output.size() << " bytes" << endl;
+   for (size_t remaining = ls_size, index = 0; remaining > 0; ++index) {
+      size_t nbytes = min (remaining, io_buffer::size());
+      send_packet (client_sock, chunks[index].data(), nbytes);
+      remaining -= nbytes;
+   }
+   elog << "sent " << ls_size << " bytes" << endl;
+}
+
+// The newline separated names in the payload of MGET and MRM.
+// A payload too large to be a list of names ends the connection.
+vector<string> recv_names (accepted_socket& client_sock,
+                           const cix_header& header, cix_arena& arena) {
+   if (header.cix_nbytes > CIX_MAX_NAMES_SIZE) {
+      throw socket_error (cix_command_name (header.cix_command)
+                          + ": payload too large");
+   }
+   char* names = (char*) arena.allocate (header.cix_nbytes);
+   if (header.cix_nbytes > 0) {
+      recv_packet (client_sock, names, header.cix_nbytes);
+   }
+   return split_lines (string (names, header.cix_nbytes));
+}
+
+// The names to act on:  wildcards are expanded unless the header
+// says the names are exact.
+vector<string> request_filenames (const cix_header& header,
+                                  const vector<string>& names) {
+   return is_exact_names (header) ? names : expand_globs (names);
+}
+
+// The payload of the request is a list of paths or wildcards.
+// Reply with a single bundle holding every matching file.
+void reply_mget (accepted_socket& client_sock, cix_header& header,
+                 cix_arena& arena) {
+   vector<string> filenames = request_filenames (header,
+                              recv_names (client_sock, header, arena));
+   elog << "sending bundle of " << filenames.size() << " entries"
+        << endl;
+   bundle_result result = send_bundle (client_sock, filenames,
+                                       exact_names_dir (header));
+   elog << "sent " << result.files << " files " << result.bytes
+        << " bytes, " << result.failed.size() << " failed" << endl;
+}
+
+// Reply to a request on many files:  a CIS_NAK for each entry that
+// failed, then a CIS_ACK with the number that worked.
+void send_batch_reply (accepted_socket& client_sock, cix_header& header,
+                       const vector<bundle_status>& failed, size_t done) {
+   for (const auto& status: failed) {
+      header.cix_command = CIS_NAK;
+      header.cix_nbytes = status.error;
+      memset (header.cix_filename, 0, CIX_FILENAME_SIZE);
+      strncpy (header.cix_filename, status.filename.c_str(),
+               CIX_FILENAME_SIZE - 1);
+      send_packet (client_sock, &header, sizeof header);
+   }
+   header.cix_command = CIS_ACK;
+   header.cix_nbytes = done;
+   memset (header.cix_filename, 0, CIX_FILENAME_SIZE);
+   elog << "sending ACK header " << header << endl;
+   send_packet (client_sock, &header, sizeof header);
+}
+
+// Store a bundle from the client, then NAK each entry that could
+// not be stored, and ACK with the number of files stored.
+void reply_mput (accepted_socket& client_sock, cix_header& header) {
+   bundle_result result;
+   vector<bundle_status> failed;
+   {
+      bundle_writer writer (is_exact_names (header) ? ""
+                                                    : CIX_PUT_SUFFIX,
+                            exact_names_dir (header));
+      result = recv_bundle (client_sock, writer);
+      failed = writer.finish();
+   }
+   elog << "received " << result.files << " files " << result.bytes
+        << " bytes, " << failed.size() << " not stored" << endl;
+   send_batch_reply (client_sock, header, failed,
+                     result.files - failed.size());
+}
+
+// Manifest of the tree under the directory named in the header,
+// with checksums if cix_nbytes is nonzero.
+void reply_manifest (accepted_socket& client_sock, cix_header& header) {
+   string dirname = header.cix_filename[0] == '\0'
+                  ? "." : header.cix_filename;
+   string text = format_manifest (build_manifest (dirname,
+                                                  header.cix_nbytes));
+   header.cix_command = CIX_LSOUT;
+   header.cix_nbytes = text.size();
+   elog << "sending header " << header << endl;
+   send_packet (client_sock, &header, sizeof header);
+   send_packet (client_sock, text.c_str(), text.size());
+   elog << "sent " << text.size() << " bytes" << endl;
+}
+
+// Conditional GET.  When the client sends a checksum, same size and
+// checksum means unchanged, whatever the mtime:  a rewrite within
+// the same second keeps it.  Without one, same size and mtime do.
+void reply_getif (accepted_socket& client_sock, cix_header& header,
+                  cix_arena& arena) {
+   cix_validator& validator = *arena.make<cix_validator>();
+   if (header.cix_nbytes != sizeof validator) {
+      throw socket_error ("CIX_GETIF: bad validator size");
+   }
+   recv_packet (client_sock, &validator, sizeof validator);
+   struct stat stat_buf;
+   if (stat (header.cix_filename, &stat_buf) < 0) {
+      elog << header.cix_filename << ": " << strerror(errno) << endl; 
+      header.cix_nbytes = errno;
+      header.cix_command = CIS_NAK;
+      elog << "sending NAK header " << header << endl;
+      send_packet (client_sock, &header, sizeof header);
+      return;
+   }
+   bool unchanged = false;
+   if (uint64_t (stat_buf.st_size) == validator.size) {
+      uint64_t checksum = 0;
+      unchanged = validator.checksum != 0
+                ? file_checksum (header.cix_filename, checksum)
+                  and checksum == validator.checksum
+                : stat_buf.st_mtime == validator.mtime;
+   }
+   if (unchanged) {
+      header.cix_command = CIX_NOTMOD;
+      header.cix_nbytes = stat_buf.st_mtime;
+      elog << "sending header " << header << endl;
+      send_packet (client_sock, &header, sizeof header);
+      return;
+   }
+   header.cix_command = CIX_MTIME;
+   header.cix_nbytes = stat_buf.st_mtime;
+   send_packet (client_sock, &header, sizeof header);
+   reply_get (client_sock, header);
+}
+
+// Buffer pool counters, as "name value" lines.  Each connection has
+// a cixserver of its own, so they count this connection only.
+void reply_stats (accepted_socket& client_sock, cix_header& header) {
+   string text = to_string (io_buffer_pool::instance().stats());
+   header.cix_command = CIX_LSOUT;
+   header.cix_nbytes = text.size();
+   elog << "sending header " << header << endl;
+   send_packet (client_sock, &header, sizeof header);
+   send_packet (client_sock, text.c_str(), text.size());
+}
+
+// Closes a file descriptor when it goes out of scope.
+struct fd_closer {
+   int fd {-1};
+   fd_closer (int fd_): fd (fd_) {}
+   ~fd_closer() { if (fd >= 0) close (fd); }
+   fd_closer (const fd_closer&) = delete;
+   fd_closer& operator= (const fd_closer&) = delete;
+};
+
+// Push the changes under the prefix in the header until the client
+// sends anything or goes away.  The payload is the last seq the
+// client saw, or 0 for changes from now on.  Changes that arrive
+// within COALESCE_MS of each other go out as one batch.
+void reply_watch (accepted_socket& client_sock, cix_header& header) {
+   static constexpr int COALESCE_MS = 50;
+   uint64_t since = 0;
+   if (header.cix_nbytes != sizeof since) {
+      throw socket_error ("CIX_WATCH: bad payload size");
+   }
+   recv_packet (client_sock, &since, sizeof since);
+   string prefix = header.cix_filename;
+   string path = get_cix_journal();
+   unique_ptr<cix_journal> journal;
+   fd_closer notify (-1);
+   try {
+      errno = ENOTSUP;
+      if (path.size() == 0) throw socket_sys_error ("CIX_WATCH");
+      journal.reset (new cix_journal (path, false));
+      notify.fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+      if (notify.fd < 0
+          or inotify_add_watch (notify.fd, path.c_str(), IN_MODIFY) < 0) {
+         throw socket_sys_error (path);
+      }
+   }catch (socket_sys_error& error) {
+      elog << error.what() << endl;
+      header.cix_command = CIS_NAK;
+      header.cix_nbytes = error.sys_errno;
+      elog << "sending NAK header " << header << endl;
+      send_packet (client_sock, &header, sizeof header);
+      return;
+   }
+   header.cix_command = CIS_ACK;
+   header.cix_nbytes = 0;
+   send_packet (client_sock, &header, sizeof header);
+   uint64_t seq = since == 0 ? journal->next_seq() : since + 1;
+   elog << "watching \"" << prefix << "\" from " << seq << endl;
+   vector<pollfd> pollfds {{client_sock.get_socket_fd(), POLLIN, 0},
+                           {notify.fd, POLLIN, 0}};
+   char drain[0x1000];
+   for (;;) {
+      vector<cix_event> records;
+      if (not journal->read (seq, records)) {
+         cix_event lost;
+         lost.seq = (records.empty() ? seq : records.front().seq) - 1;
+         records.insert (records.begin(), lost);
+      }
+      vector<cix_event> batch = coalesce_events (records, prefix);
+      if (batch.size() > 0) {
+         header.cix_command = CIX_EVENTS;
+         header.cix_nbytes = batch.size() * sizeof (cix_event);
+         send_packet (client_sock, &header, sizeof header);
+         send_packet (client_sock, batch.data(), header.cix_nbytes);
+         elog << "sent " << batch.size() << " events of "
+              << records.size() << endl;
+      }
+      int rc = poll (pollfds.data(), pollfds.size(), -1);
+      if (rc < 0 and errno == EINTR) continue;
+      if (rc < 0) throw socket_sys_error ("poll");
+      if (pollfds[0].revents != 0) break;
+      usleep (COALESCE_MS * 1000);
+      while (read (notify.fd, drain, sizeof drain) > 0) continue;
+   }
+   elog << "watch ended at " << seq << endl;
+}
+
+// Batch RM:  the payload lists paths or wildcards, as for MGET.
+void reply_mrm (accepted_socket& client_sock, cix_header& header,
+                cix_arena& arena) {
+   vector<string> filenames = request_filenames (header,
+                              recv_names (client_sock, header, arena));
+   vector<bundle_status> failed;
+   for (const auto& filename: filenames) {
+      if (unlink (filename.c_str()) < 0) {
+         failed.push_back ({filename, errno});
+      }
+   }
+   elog << "removed " << filenames.size() - failed.size() << " of "
+        << filenames.size() << " files" << endl;
+   send_batch_reply (client_sock, header, failed,
+                     filenames.size() - failed.size());
+}
+
+// In-kernel copy of size bytes, or read and write where the kernel
+// can not copy between the two files.  A source that gets shorter
+// meanwhile is EIO, so the truncated copy is not kept.
+int copy_range (int in_fd, int out_fd, off_t size) {
+   off_t remaining = size;
+   while (remaining > 0) {
+      ssize_t nbytes = copy_file_range (in_fd, nullptr, out_fd, nullptr,
+                                        remaining, 0);
+      if (nbytes < 0 and remaining == size
+          and (errno == EXDEV or errno == ENOSYS or errno == EINVAL
+               or errno == EOPNOTSUPP)) break;
+      if (nbytes < 0) return errno;
+      if (nbytes == 0) return EIO;
+      remaining -= nbytes;
+   }
+   io_buffer buffer;
+   while (remaining > 0) {
+      ssize_t nbytes = read (in_fd, buffer.data(), buffer.size());
+      if (nbytes < 0) return errno;
+      if (nbytes == 0) return EIO;
+      if (write (out_fd, buffer.data(), nbytes) != nbytes) return EIO;
+      remaining -= nbytes;
+   }
+   return 0;
+}
+
+// Copy into a temporary next to the destination and rename it into
+// place, so nobody sees a partial copy.  A reflink shares the blocks
+// where the filesystem can.  Returns 0 or errno.
+int copy_file (const string& source, const string& dest) {
+   int in_fd = open (source.c_str(), O_RDONLY | O_CLOEXEC);
+   if (in_fd < 0) return errno;
+   struct stat stat_buf;
+   int error = fstat (in_fd, &stat_buf) < 0 ? errno
+             : S_ISREG (stat_buf.st_mode) ? 0 : EINVAL;
+   if (error != 0) {
+      close (in_fd);
+      return error;
+   }
+   make_parent_dirs (dest);
+   string temp = dest + ".cixcopy." + to_string (getpid());
+   int out_fd = open (temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC
+                      | O_CLOEXEC, stat_buf.st_mode & 0777);
+   if (out_fd < 0) {
+      error = errno;
+      close (in_fd);
+      return error;
+   }
+   if (ioctl (out_fd, FICLONE, in_fd) < 0) {
+      error = copy_range (in_fd, out_fd, stat_buf.st_size);
+   }
+   if (close (out_fd) < 0 and error == 0) error = errno;
+   close (in_fd);
+   if (error == 0 and rename (temp.c_str(), dest.c_str()) < 0) {
+      error = errno;
+   }
+   if (error != 0) unlink (temp.c_str());
+   return error;
+}
+
+// COPY and MOVE name the source in the header and the destination
+// in the payload.  MOVE is a rename, so it is atomic.  A destination
+// that could not fit in a header ends the connection unread.
+void reply_copy (accepted_socket& client_sock, cix_header& header,
+                 cix_arena& arena) {
+   if (header.cix_nbytes >= CIX_FILENAME_SIZE) {
+      throw socket_error (cix_command_name (header.cix_command)
+                          + ": destination too long");
+   }
+   char* dest = (char*) arena.allocate (header.cix_nbytes + 1);
+   if (header.cix_nbytes > 0) {
+      recv_packet (client_sock, dest, header.cix_nbytes);
+   }
+   dest[header.cix_nbytes] = '\0';
+   int error = 0;
+   if (header.cix_nbytes == 0) {
+      error = ENOENT;
+   }else if (not safe_path (dest)) {
+      error = EACCES;
+   }else if (header.cix_command == CIX_COPY) {
+      error = copy_file (header.cix_filename, dest);
+   }else {
+      make_parent_dirs (dest);
+      if (rename (header.cix_filename, dest) < 0) error = errno;
+   }
+   if (error != 0) {
+      elog << header.cix_filename << " -> " << dest << ": "
+           << strerror (error) << endl;
+      header.cix_command = CIS_NAK;
+   }else {
+      header.cix_command = CIS_ACK;
+   }
+   header.cix_nbytes = error;
+   elog << "sending header " << header << endl;
+   send_packet (client_sock, &header, sizeof header);
 }
 
 
@@ -106,13 +642,19 @@ int main (int argc, char**argv) {
    vector<string> args (&argv[1], &argv[argc]);
    int client_fd = stoi (args[0]);
    elog << "starting client_fd " << client_fd << endl;
+   cix_trace_writer trace;
    try {
       accepted_socket client_sock (client_fd);
       elog << "connected to " << to_string (client_sock) << endl;
+      replication primary = get_replication();
+      replication chained;
+      bool have_chain = false;
       for (;;) {
-         cix_header header;
+         cix_arena arena;
+         cix_header& header = *arena.make<cix_header>();
          recv_packet (client_sock, &header, sizeof header);
          elog << "received header " << header << endl;
+         trace.begin (client_sock, header);
          switch (header.cix_command) {
             case CIX_LS:
                reply_ls (client_sock, header);
@@ -120,12 +662,43 @@ int main (int argc, char**argv) {
             case CIX_GET:
                reply_get (client_sock, header);
                break;
+            case CIX_CHAIN:
+               chained = recv_chain (client_sock, header, arena);
+               have_chain = true;
+               break;
             case CIX_PUT:
-               reply_put (client_sock, header);
+               reply_put (client_sock, header,
+                          have_chain ? chained : primary);
+               have_chain = false;
                break;
             case CIX_RM:
                reply_rm (client_sock, header);
                break;
+            case CIX_MGET:
+               reply_mget (client_sock, header, arena);
+               break;
+            case CIX_MPUT:
+               reply_mput (client_sock, header);
+               break;
+            case CIX_MANIFEST:
+               reply_manifest (client_sock, header);
+               break;
+            case CIX_GETIF:
+               reply_getif (client_sock, header, arena);
+               break;
+            case CIX_STATS:
+               reply_stats (client_sock, header);
+               break;
+            case CIX_WATCH:
+               reply_watch (client_sock, header);
+               break;
+            case CIX_COPY:
+            case CIX_MOVE:
+               reply_copy (client_sock, header, arena);
+               break;
+            case CIX_MRM:
+               reply_mrm (client_sock, header, arena);
+               break;
             default:
                elog << "invalid header from client" << endl;
                elog << "cix_nbytes = " << header.cix_nbytes << endl;
@@ -133,10 +706,15 @@ int main (int argc, char**argv) {
                elog << "cix_filename = " << header.cix_filename << endl;
                break;
          }
+         trace.end (client_sock, header);
       }
    }catch (socket_error& error) {
       elog << error.what() << endl;
    }
+   io_pool_stats stats = io_buffer_pool::instance().stats();
+   elog << "buffer pool: " << stats.buffers << " buffers, peak "
+        << stats.peak_in_use << " in use, " << stats.acquires
+        << " acquires" << endl;
    elog << "finishing" << endl;
    return 0;
 }
@@ -0,0 +1,107 @@
+// $Id$
+
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+using namespace std;
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cixtrace.h"
+#include "logstream.h"
+
+extern logstream elog;
+
+static constexpr char TRACE_MAGIC[8] = {'C','I','X','T','R','C','0','1'};
+
+static int64_t clock_ns (clockid_t clock) {
+   timespec now;
+   clock_gettime (clock, &now);
+   return int64_t (now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+cix_trace_writer::cix_trace_writer() {
+   char* prefix = getenv ("CIX_TRACE");
+   if (prefix == nullptr or *prefix == '\0') return;
+   path = string (prefix) + "." + to_string (getpid());
+   fd = open (path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0644);
+   if (fd < 0) {
+      elog << path << ": " << strerror (errno) << endl;
+      return;
+   }
+   if (write (fd, TRACE_MAGIC, sizeof TRACE_MAGIC)
+       != sizeof TRACE_MAGIC) {
+      elog << path << ": " << strerror (errno) << endl;
+      close (fd);
+      fd = -1;
+      return;
+   }
+   buffer.reserve (BUFFERED_RECORDS);
+   current.connection = getpid();
+}
+
+cix_trace_writer::~cix_trace_writer() {
+   if (fd < 0) return;
+   flush();
+   close (fd);
+}
+
+// A trace that can not be written is given up, not the connection.
+void cix_trace_writer::flush() {
+   size_t nbytes = buffer.size() * sizeof (cix_trace_record);
+   ssize_t written = write (fd, buffer.data(), nbytes);
+   if (written != ssize_t (nbytes)) {
+      elog << path << ": " << strerror (errno) << endl;
+      close (fd);
+      fd = -1;
+   }
+   buffer.clear();
+}
+
+void cix_trace_writer::begin (const base_socket& socket,
+                              const cix_header& header) {
+   if (fd < 0) return;
+   current.start_ns = clock_ns (CLOCK_REALTIME);
+   start_mono_ns = clock_ns (CLOCK_MONOTONIC);
+   current.cix_nbytes = header.cix_nbytes;
+   current.cix_command = header.cix_command;
+   memcpy (current.cix_filename, header.cix_filename, CIX_FILENAME_SIZE);
+   received = socket.get_bytes_received();
+   sent = socket.get_bytes_sent();
+}
+
+void cix_trace_writer::end (const base_socket& socket,
+                            const cix_header& reply) {
+   if (fd < 0) return;
+   current.duration_ns = clock_ns (CLOCK_MONOTONIC) - start_mono_ns;
+   current.bytes_in = socket.get_bytes_received() - received;
+   current.bytes_out = socket.get_bytes_sent() - sent;
+   current.reply_nbytes = reply.cix_nbytes;
+   current.reply_command = reply.cix_command;
+   buffer.push_back (current);
+   if (buffer.size() == BUFFERED_RECORDS) flush();
+}
+
+vector<cix_trace_record> read_trace (const string& path) {
+   int fd = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) throw socket_sys_error (path);
+   char magic[sizeof TRACE_MAGIC];
+   if (read (fd, magic, sizeof magic) != sizeof magic
+       or memcmp (magic, TRACE_MAGIC, sizeof magic) != 0) {
+      close (fd);
+      throw socket_error (path + ": not a cix trace");
+   }
+   vector<cix_trace_record> records;
+   for (;;) {
+      cix_trace_record record;
+      ssize_t nbytes = read (fd, &record, sizeof record);
+      if (nbytes < 0 and errno == EINTR) continue;
+      if (nbytes != sizeof record) break;
+      records.push_back (record);
+   }
+   close (fd);
+   return records;
+}
+
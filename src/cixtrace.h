@@ -0,0 +1,71 @@
+// $Id$
+
+//
+// Request traces for cixreplay.
+// With $CIX_TRACE set, each cixserver writes a fixed size record for
+// every request it answers to $CIX_TRACE.<pid>.  Records are kept
+// in memory and written out a buffer at a time, so tracing costs a
+// copy of the header and two clock reads per request.
+//
+
+#ifndef __CIXTRACE_H__
+#define __CIXTRACE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cixlib.h"
+#include "sockets.h"
+
+// The header of a request and what it cost.  Bytes do not count
+// the request header itself.
+struct cix_trace_record {
+   int64_t start_ns {0};        // realtime, to merge connections
+   uint64_t duration_ns {0};    // header received to reply sent
+   uint64_t bytes_in {0};
+   uint64_t bytes_out {0};
+   uint32_t connection {0};     // pid of the cixserver
+   uint32_t cix_nbytes {0};
+   uint32_t reply_nbytes {0};
+   uint8_t cix_command {0};
+   uint8_t reply_command {0};   // the last header sent
+   char cix_filename[CIX_FILENAME_SIZE];
+   cix_trace_record() { memset (cix_filename, 0, CIX_FILENAME_SIZE); }
+};
+
+//
+// class cix_trace_writer
+// records requests on one connection.  Does nothing unless
+// $CIX_TRACE is set.
+//
+
+class cix_trace_writer {
+   private:
+      static constexpr size_t BUFFERED_RECORDS = 512;
+      int fd {-1};
+      string path;
+      vector<cix_trace_record> buffer;
+      cix_trace_record current;
+      int64_t start_mono_ns {0};
+      uint64_t received {0};
+      uint64_t sent {0};
+      void flush();
+      cix_trace_writer (const cix_trace_writer&) = delete;
+      cix_trace_writer& operator= (const cix_trace_writer&) = delete;
+   public:
+      cix_trace_writer();
+      ~cix_trace_writer();
+      bool enabled() const { return fd >= 0; }
+      // begin when the header has arrived, end when the reply is
+      // out with the header as the handler left it.
+      void begin (const base_socket& socket, const cix_header& header);
+      void end (const base_socket& socket, const cix_header& reply);
+};
+
+// Every record of a trace file.
+vector<cix_trace_record> read_trace (const string& path);
+
+#endif
+
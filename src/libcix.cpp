@@ -0,0 +1,737 @@
+// $Id$
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cixbuffer.h"
+#include "libcix.h"
+
+namespace {
+
+cix_error sys_error (cix_errc code, const string& what,
+                     int errnum = errno) {
+   return {code, errnum, what + ": " + strerror (errnum)};
+}
+
+// The daemon answered CIS_NAK with its errno.
+cix_error remote_error (const cix_header& header) {
+   return {cix_errc::remote, int (header.cix_nbytes),
+           string (header.cix_filename) + ": "
+           + strerror (header.cix_nbytes)};
+}
+
+cix_error protocol_error (cix_command sent, const cix_header& reply) {
+   return {cix_errc::protocol, 0, "sent " + cix_command_name (sent)
+           + ", daemon replied "
+           + cix_command_name (reply.cix_command)};
+}
+
+// Paths that do not fit in a header can not be sent.
+bool set_filename (cix_header& header, const string& filename) {
+   if (filename.size() >= CIX_FILENAME_SIZE) return false;
+   strcpy (header.cix_filename, filename.c_str());
+   return true;
+}
+
+cix_error name_too_long (const string& filename) {
+   return sys_error (cix_errc::invalid, filename, ENAMETOOLONG);
+}
+
+template <typename T>
+cix_task<cix_result<T>> failed_request (cix_error error) {
+   co_return error;
+}
+
+}
+
+
+cix_event_loop::cix_event_loop():
+                epoll_fd (epoll_create1 (EPOLL_CLOEXEC)) {
+   if (epoll_fd < 0) throw socket_sys_error ("epoll_create1");
+}
+
+cix_event_loop::~cix_event_loop() {
+   spawned.clear();
+   close (epoll_fd);
+}
+
+// An fd nobody waits on is taken out of the epoll set:  left in with
+// an empty mask, a hangup would still be reported on every pass.
+void cix_event_loop::update (int fd, io_waiters& entry) {
+   if (not entry.reader and not entry.writer) {
+      if (entry.registered) epoll_ctl (epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+      entry.registered = false;
+      return;
+   }
+   epoll_event event {};
+   event.events = (entry.reader ? uint32_t (EPOLLIN) : 0)
+                | (entry.writer ? uint32_t (EPOLLOUT) : 0);
+   event.data.fd = fd;
+   int op = entry.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+   if (epoll_ctl (epoll_fd, op, fd, &event) < 0) {
+      throw socket_sys_error ("epoll_ctl");
+   }
+   entry.registered = true;
+}
+
+void cix_event_loop::wait_io (int fd, bool write,
+                              coroutine_handle<> handle) {
+   io_waiters& entry = waiters[fd];
+   (write ? entry.writer : entry.reader) = handle;
+   update (fd, entry);
+}
+
+void cix_event_loop::forget (int fd) {
+   const auto& itor = waiters.find (fd);
+   if (itor == waiters.end()) return;
+   if (itor->second.registered) {
+      epoll_ctl (epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+   }
+   waiters.erase (itor);
+}
+
+// Make the timers that are due ready.  Returns the milliseconds
+// until the next one, or -1 if there is none.
+int cix_event_loop::expire_timers() {
+   auto now = chrono::steady_clock::now();
+   while (not timers.empty() and timers.begin()->first <= now) {
+      ready.push_back (timers.begin()->second);
+      timers.erase (timers.begin());
+   }
+   if (timers.empty()) return -1;
+   auto wait = chrono::ceil<chrono::milliseconds> (
+               timers.begin()->first - now);
+   return wait.count();
+}
+
+// Resume what is ready, or else wait for the sockets.
+void cix_event_loop::run_once() {
+   int timeout = expire_timers();
+   if (ready.empty()) {
+      bool waiting = not timers.empty();
+      for (const auto& entry: waiters) {
+         if (entry.second.reader or entry.second.writer) waiting = true;
+      }
+      if (not waiting) {
+         throw logic_error ("cix_event_loop: tasks are stuck");
+      }
+      epoll_event events[64];
+      int count = epoll_wait (epoll_fd, events, 64, timeout);
+      if (count < 0) {
+         if (errno == EINTR) return;
+         throw socket_sys_error ("epoll_wait");
+      }
+      for (int index = 0; index < count; ++index) {
+         io_waiters& entry = waiters[events[index].data.fd];
+         uint32_t flags = events[index].events;
+         bool failed = flags & (EPOLLHUP | EPOLLERR);
+         if (entry.reader and (failed or flags & EPOLLIN)) {
+            ready.push_back (entry.reader);
+            entry.reader = nullptr;
+         }
+         if (entry.writer and (failed or flags & EPOLLOUT)) {
+            ready.push_back (entry.writer);
+            entry.writer = nullptr;
+         }
+         update (events[index].data.fd, entry);
+      }
+      expire_timers();
+   }
+   deque<coroutine_handle<>> now;
+   now.swap (ready);
+   for (auto handle: now) handle.resume();
+}
+
+void cix_event_loop::spawn (cix_task<void> task) {
+   spawned.push_back (std::move (task));
+   spawned.back().start();
+}
+
+void cix_event_loop::run() {
+   for (;;) {
+      for (auto itor = spawned.begin(); itor != spawned.end(); ) {
+         if (not itor->done()) { ++itor; continue; }
+         cix_task<void> task = std::move (*itor);
+         itor = spawned.erase (itor);
+         task.result();
+      }
+      if (spawned.empty()) break;
+      run_once();
+   }
+}
+
+
+// Name lookup blocks; everything after it does not.
+cix_task<cix_result<cix_connection::pointer>>
+cix_connection::open (cix_event_loop& loop, string node) {
+   vector<pair<sockaddr_storage,socklen_t>> addresses;
+   bool local = node.find ('/') != string::npos;
+   if (local) {
+      sockaddr_un addr {};
+      addr.sun_family = AF_UNIX;
+      if (node.size() >= sizeof addr.sun_path) {
+         co_return name_too_long (node);
+      }
+      strcpy (addr.sun_path, node.c_str());
+      sockaddr_storage storage {};
+      memcpy (&storage, &addr, sizeof addr);
+      addresses.push_back ({storage, sizeof addr});
+   }else {
+      pair<string,in_port_t> host_port;
+      try {
+         host_port = split_host_port (node, 50000);
+      }catch (socket_error& error) {
+         co_return cix_error {cix_errc::invalid, 0, error.what()};
+      }
+      addrinfo hints {};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo* found = nullptr;
+      int rc = getaddrinfo (host_port.first.c_str(),
+                            to_string (host_port.second).c_str(),
+                            &hints, &found);
+      if (rc != 0) {
+         co_return cix_error {cix_errc::connect, 0,
+                              node + ": " + gai_strerror (rc)};
+      }
+      for (addrinfo* info = found; info != nullptr;
+                     info = info->ai_next) {
+         sockaddr_storage storage {};
+         memcpy (&storage, info->ai_addr, info->ai_addrlen);
+         addresses.push_back ({storage, info->ai_addrlen});
+      }
+      freeaddrinfo (found);
+   }
+   int error = ECONNREFUSED;
+   for (auto& address: addresses) {
+      int fd = socket (address.first.ss_family,
+                       SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd < 0) { error = errno; continue; }
+      if (::connect (fd, (sockaddr*) &address.first,
+                     address.second) < 0) {
+         error = errno;
+         if (error == EINPROGRESS or error == EAGAIN) {
+            co_await loop.writable (fd);
+            loop.forget (fd);
+            socklen_t size = sizeof error;
+            getsockopt (fd, SOL_SOCKET, SO_ERROR, &error, &size);
+         }
+      }else {
+         error = 0;
+      }
+      if (error == 0) {
+         co_return pointer (new cix_connection (loop, fd, local));
+      }
+      close (fd);
+   }
+   co_return sys_error (cix_errc::connect, node, error);
+}
+
+cix_connection::~cix_connection() {
+   loop.forget (fd);
+   close (fd);
+}
+
+cix_task<cix_result<void>> cix_connection::send (const void* buffer,
+                                                 size_t size) {
+   const char* data = static_cast<const char*> (buffer);
+   while (size > 0) {
+      ssize_t nbytes = ::send (fd, data, size, MSG_NOSIGNAL);
+      if (nbytes < 0) {
+         if (errno == EAGAIN or errno == EWOULDBLOCK) {
+            co_await loop.writable (fd);
+            continue;
+         }
+         if (errno == EINTR) continue;
+         co_return sys_error (cix_errc::io, "send");
+      }
+      data += nbytes;
+      size -= nbytes;
+   }
+   co_return {};
+}
+
+cix_task<cix_result<void>> cix_connection::recv (void* buffer,
+                                                 size_t size,
+                                                 int* fd_passed) {
+   char* data = static_cast<char*> (buffer);
+   if (fd_passed != nullptr) *fd_passed = -1;
+   while (size > 0) {
+      iovec iov {data, size};
+      msghdr message {};
+      message.msg_iov = &iov;
+      message.msg_iovlen = 1;
+      char control[CMSG_SPACE (sizeof (int))];
+      if (fd_passed != nullptr and *fd_passed < 0) {
+         message.msg_control = control;
+         message.msg_controllen = sizeof control;
+      }
+      ssize_t nbytes = recvmsg (fd, &message, MSG_CMSG_CLOEXEC);
+      if (nbytes < 0) {
+         if (errno == EAGAIN or errno == EWOULDBLOCK) {
+            co_await loop.readable (fd);
+            continue;
+         }
+         if (errno == EINTR) continue;
+         co_return sys_error (cix_errc::io, "recv");
+      }
+      if (nbytes == 0) {
+         co_return cix_error {cix_errc::closed, 0, "connection closed"};
+      }
+      if (message.msg_controllen > 0) {
+         cmsghdr* cmsg = CMSG_FIRSTHDR (&message);
+         if (cmsg != nullptr and cmsg->cmsg_level == SOL_SOCKET
+                             and cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy (fd_passed, CMSG_DATA (cmsg), sizeof (int));
+         }
+      }
+      data += nbytes;
+      size -= nbytes;
+   }
+   co_return {};
+}
+
+cix_task<cix_result<void>> cix_connection::request (cix_header& header,
+                                                    const void* payload) {
+   auto sent = co_await send (&header, sizeof header);
+   if (sent and header.cix_nbytes > 0 and payload != nullptr) {
+      sent = co_await send (payload, header.cix_nbytes);
+   }
+   co_return sent;
+}
+
+// The reply to GET or GET_IF once any CIX_MTIME is out of the way,
+// with the descriptor that came with it, or -1.
+cix_task<cix_result<cix_file_info>> cix_connection::recv_file (
+               cix_header& header, int64_t mtime, int file_fd,
+               cix_sink& sink) {
+   if (header.cix_command != CIX_FILEFD and file_fd >= 0) {
+      close (file_fd);
+   }
+   if (header.cix_command == CIS_NAK) co_return remote_error (header);
+   cix_file_info info;
+   info.size = header.cix_nbytes;
+   info.mtime = mtime;
+   if (header.cix_command == CIX_FILEFD) {
+      if (file_fd < 0) co_return protocol_error (CIX_GET, header);
+      // Mapping past the end of a file that was cut short since the
+      // header was sent would raise SIGBUS.
+      struct stat stat_buf;
+      int error = fstat (file_fd, &stat_buf) < 0 ? errno
+                : uint64_t (stat_buf.st_size) < info.size ? EIO : 0;
+      if (error != 0) {
+         close (file_fd);
+         co_return sys_error (cix_errc::io, "CIX_FILEFD", error);
+      }
+      if (info.size > 0) {
+         void* mapped = mmap (nullptr, info.size, PROT_READ, MAP_PRIVATE,
+                              file_fd, 0);
+         if (mapped == MAP_FAILED) {
+            cix_error error = sys_error (cix_errc::io, "mmap");
+            close (file_fd);
+            co_return error;
+         }
+         sink (static_cast<const char*> (mapped), info.size);
+         munmap (mapped, info.size);
+      }
+      close (file_fd);
+      co_return info;
+   }
+   if (header.cix_command != CIX_FILE) {
+      co_return protocol_error (CIX_GET, header);
+   }
+   io_buffer buffer;
+   for (uint64_t remaining = info.size; remaining > 0; ) {
+      size_t nbytes = min<uint64_t> (remaining, buffer.size());
+      auto got = co_await recv (buffer.data(), nbytes);
+      if (not got) co_return got.error();
+      sink (buffer.data(), nbytes);
+      remaining -= nbytes;
+   }
+   co_return info;
+}
+
+cix_task<cix_result<cix_file_info>> cix_connection::get (string filename,
+                                                         cix_sink sink) {
+   cix_header header;
+   header.cix_command = CIX_GET;
+   if (not set_filename (header, filename)) {
+      co_return name_too_long (filename);
+   }
+   auto sent = co_await request (header);
+   if (not sent) co_return sent.error();
+   int file_fd = -1;
+   auto got = co_await recv (&header, sizeof header,
+                             local ? &file_fd : nullptr);
+   if (not got) co_return got.error();
+   co_return co_await recv_file (header, -1, file_fd, sink);
+}
+
+cix_task<cix_result<cix_file_info>> cix_connection::get_if (
+               string filename, cix_validator validator,
+               cix_sink sink) {
+   cix_header header;
+   header.cix_command = CIX_GETIF;
+   header.cix_nbytes = sizeof validator;
+   if (not set_filename (header, filename)) {
+      co_return name_too_long (filename);
+   }
+   auto sent = co_await request (header, &validator);
+   if (not sent) co_return sent.error();
+   auto got = co_await recv (&header, sizeof header);
+   if (not got) co_return got.error();
+   if (header.cix_command == CIX_NOTMOD) {
+      cix_file_info info;
+      info.size = validator.size;
+      info.mtime = header.cix_nbytes;
+      info.not_modified = true;
+      co_return info;
+   }
+   int64_t mtime = -1;
+   int file_fd = -1;
+   if (header.cix_command == CIX_MTIME) {
+      mtime = header.cix_nbytes;
+      got = co_await recv (&header, sizeof header,
+                           local ? &file_fd : nullptr);
+      if (not got) co_return got.error();
+   }
+   co_return co_await recv_file (header, mtime, file_fd, sink);
+}
+
+// A source that runs dry ends the connection before the daemon has
+// the size it was promised, so it stores nothing.  A file too large
+// for cix_nbytes is refused before anything is sent.
+cix_task<cix_result<uint32_t>> cix_connection::put (string filename,
+                                                    uint64_t size,
+                                                    cix_source source) {
+   if (size > UINT32_MAX) co_return sys_error (cix_errc::invalid,
+                                               filename, EFBIG);
+   cix_header header;
+   header.cix_command = CIX_PUT;
+   header.cix_nbytes = size;
+   if (not set_filename (header, filename)) {
+      co_return name_too_long (filename);
+   }
+   auto sent = co_await request (header);
+   if (not sent) co_return sent.error();
+   io_buffer buffer;
+   for (uint64_t remaining = size; remaining > 0; ) {
+      size_t nbytes = min<uint64_t> (remaining, buffer.size());
+      if (source (buffer.data(), nbytes) < nbytes) {
+         shutdown (fd, SHUT_RDWR);
+         co_return sys_error (cix_errc::io, filename, EIO);
+      }
+      sent = co_await send (buffer.data(), nbytes);
+      if (not sent) co_return sent.error();
+      remaining -= nbytes;
+   }
+   auto got = co_await recv (&header, sizeof header);
+   if (not got) co_return got.error();
+   if (header.cix_command == CIS_NAK) co_return remote_error (header);
+   if (header.cix_command != CIS_ACK) {
+      co_return protocol_error (CIX_PUT, header);
+   }
+   co_return header.cix_nbytes;
+}
+
+cix_task<cix_result<void>> cix_connection::rm (string filename) {
+   cix_header header;
+   header.cix_command = CIX_RM;
+   if (not set_filename (header, filename)) {
+      co_return name_too_long (filename);
+   }
+   auto sent = co_await request (header);
+   if (not sent) co_return sent.error();
+   auto got = co_await recv (&header, sizeof header);
+   if (not got) co_return got.error();
+   if (header.cix_command == CIS_NAK) co_return remote_error (header);
+   if (header.cix_command != CIS_ACK) {
+      co_return protocol_error (CIX_RM, header);
+   }
+   co_return {};
+}
+
+cix_task<cix_result<cix_batch_result>> cix_connection::rm (
+               vector<string> patterns) {
+   string payload;
+   for (const auto& pattern: patterns) payload += pattern + "\n";
+   if (payload.size() > CIX_MAX_NAMES_SIZE) {
+      co_return sys_error (cix_errc::invalid, "rm", E2BIG);
+   }
+   cix_header header;
+   header.cix_command = CIX_MRM;
+   header.cix_nbytes = payload.size();
+   auto sent = co_await request (header, payload.c_str());
+   if (not sent) co_return sent.error();
+   cix_batch_result result;
+   for (;;) {
+      auto got = co_await recv (&header, sizeof header);
+      if (not got) co_return got.error();
+      if (header.cix_command == CIS_ACK) break;
+      if (header.cix_command != CIS_NAK) {
+         co_return protocol_error (CIX_MRM, header);
+      }
+      result.failed.push_back ({header.cix_filename,
+                                int (header.cix_nbytes)});
+   }
+   result.done = header.cix_nbytes;
+   co_return result;
+}
+
+cix_task<cix_result<void>> cix_connection::copy_request (
+               cix_command command, string source, string dest) {
+   cix_header header;
+   header.cix_command = command;
+   header.cix_nbytes = dest.size();
+   if (not set_filename (header, source)) {
+      co_return name_too_long (source);
+   }
+   if (dest.size() >= CIX_FILENAME_SIZE) co_return name_too_long (dest);
+   auto sent = co_await request (header, dest.c_str());
+   if (not sent) co_return sent;
+   auto got = co_await recv (&header, sizeof header);
+   if (not got) co_return got;
+   if (header.cix_command == CIS_NAK) co_return remote_error (header);
+   if (header.cix_command != CIS_ACK) {
+      co_return protocol_error (command, header);
+   }
+   co_return {};
+}
+
+cix_task<cix_result<void>> cix_connection::copy (string source,
+                                                 string dest) {
+   return copy_request (CIX_COPY, source, dest);
+}
+
+cix_task<cix_result<void>> cix_connection::move (string source,
+                                                 string dest) {
+   return copy_request (CIX_MOVE, source, dest);
+}
+
+// Requests answered with CIX_LSOUT text.
+cix_task<cix_result<string>> cix_connection::recv_text (
+               cix_command command) {
+   cix_header header;
+   header.cix_command = command;
+   auto sent = co_await request (header);
+   if (not sent) co_return sent.error();
+   auto got = co_await recv (&header, sizeof header);
+   if (not got) co_return got.error();
+   if (header.cix_command != CIX_LSOUT) {
+      co_return protocol_error (command, header);
+   }
+   string text (header.cix_nbytes, '\0');
+   if (text.size() > 0) {
+      got = co_await recv (&text[0], text.size());
+      if (not got) co_return got.error();
+   }
+   co_return text;
+}
+
+cix_task<cix_result<string>> cix_connection::ls() {
+   return recv_text (CIX_LS);
+}
+
+cix_task<cix_result<string>> cix_connection::stats() {
+   return recv_text (CIX_STATS);
+}
+
+cix_task<cix_result<void>> cix_connection::watch (
+               string prefix, uint64_t since,
+               function<bool (const cix_event&)> handler) {
+   cix_header header;
+   header.cix_command = CIX_WATCH;
+   header.cix_nbytes = sizeof since;
+   if (not set_filename (header, prefix)) {
+      co_return name_too_long (prefix);
+   }
+   auto sent = co_await request (header, &since);
+   if (not sent) co_return sent;
+   auto got = co_await recv (&header, sizeof header);
+   if (not got) co_return got;
+   if (header.cix_command == CIS_NAK) co_return remote_error (header);
+   if (header.cix_command != CIS_ACK) {
+      co_return protocol_error (CIX_WATCH, header);
+   }
+   vector<cix_event> events;
+   for (;;) {
+      got = co_await recv (&header, sizeof header);
+      if (not got) co_return got;
+      if (header.cix_command != CIX_EVENTS
+          or header.cix_nbytes % sizeof (cix_event) != 0) {
+         co_return protocol_error (CIX_WATCH, header);
+      }
+      events.resize (header.cix_nbytes / sizeof (cix_event));
+      got = co_await recv (events.data(), header.cix_nbytes);
+      if (not got) co_return got;
+      for (const auto& event: events) {
+         if (not handler (event)) co_return {};
+      }
+   }
+}
+
+
+cix_pool::cix_pool (cix_event_loop& loop, const vector<string>& nodes,
+                    size_t max_connections):
+          loop (loop), max_connections (max_connections) {
+   for (const auto& node: nodes) add (node);
+}
+
+void cix_pool::add (const string& node) {
+   ring.add (node);
+   slots[node];
+}
+
+// Requests still waiting for the node wake up and fail.
+void cix_pool::remove (const string& node) {
+   ring.remove (node);
+   const auto& itor = slots.find (node);
+   if (itor == slots.end()) return;
+   for (auto handle: itor->second.waiting) loop.post (handle);
+   slots.erase (itor);
+}
+
+cix_task<cix_result<cix_connection::pointer>>
+cix_pool::acquire (string node) {
+   for (;;) {
+      const auto& itor = slots.find (node);
+      if (itor == slots.end()) {
+         co_return sys_error (cix_errc::connect, node, ENOENT);
+      }
+      node_slot& slot = itor->second;
+      if (not slot.idle.empty()) {
+         cix_connection::pointer conn = std::move (slot.idle.back());
+         slot.idle.pop_back();
+         co_return conn;
+      }
+      if (slot.open < max_connections) {
+         ++slot.open;
+         auto conn = co_await cix_connection::open (loop, node);
+         if (not conn) release (node, nullptr, false);
+         co_return conn;
+      }
+      co_await slot_awaiter {slot.waiting};
+   }
+}
+
+void cix_pool::release (const string& node, cix_connection::pointer conn,
+                        bool reuse) {
+   const auto& itor = slots.find (node);
+   if (itor == slots.end()) return;
+   node_slot& slot = itor->second;
+   if (reuse and conn != nullptr) slot.idle.push_back (std::move (conn));
+   else --slot.open;
+   if (not slot.waiting.empty()) {
+      loop.post (slot.waiting.front());
+      slot.waiting.pop_front();
+   }
+}
+
+cix_task<cix_result<cix_file_info>> cix_pool::get (string filename,
+                                                   cix_sink sink) {
+   return with_connection<cix_file_info> (route (filename),
+          [filename, sink] (cix_connection& conn) {
+             return conn.get (filename, sink);
+          });
+}
+
+cix_task<cix_result<cix_file_info>> cix_pool::get_if (
+               string filename, cix_validator validator,
+               cix_sink sink) {
+   return with_connection<cix_file_info> (route (filename),
+          [filename, validator, sink] (cix_connection& conn) {
+             return conn.get_if (filename, validator, sink);
+          });
+}
+
+cix_task<cix_result<uint32_t>> cix_pool::put (string filename,
+                                              uint64_t size,
+                                              cix_source source) {
+   return with_connection<uint32_t> (route (filename),
+          [filename, size, source] (cix_connection& conn) {
+             return conn.put (filename, size, source);
+          });
+}
+
+cix_task<cix_result<void>> cix_pool::rm (string filename) {
+   return with_connection<void> (route (filename),
+          [filename] (cix_connection& conn) {
+             return conn.rm (filename);
+          });
+}
+
+// One batch per daemon, in turn.  A wildcard that matches nothing
+// on some of several daemons is not an error.
+cix_task<cix_result<cix_batch_result>> cix_pool::rm (
+               vector<string> patterns) {
+   map<string,vector<string>> requests;
+   for (const auto& pattern: patterns) {
+      if (pattern.find_first_of ("*?[") == string::npos) {
+         requests[route (pattern)].push_back (pattern);
+      }else {
+         for (const auto& node: nodes()) requests[node].push_back (pattern);
+      }
+   }
+   bool fanned_out = nodes().size() > 1;
+   cix_batch_result total;
+   for (const auto& request: requests) {
+      auto rm_names = [names = request.second] (cix_connection& conn) {
+         return conn.rm (names);
+      };
+      auto result = co_await with_connection<cix_batch_result> (
+                    request.first, rm_names);
+      if (not result) co_return result;
+      total.done += result->done;
+      for (const auto& status: result->failed) {
+         if (fanned_out and status.second == ENOENT
+             and status.first.find_first_of ("*?[") != string::npos) {
+            continue;
+         }
+         total.failed.push_back (status);
+      }
+   }
+   co_return total;
+}
+
+cix_task<cix_result<void>> cix_pool::copy (string source, string dest) {
+   if (route (source) != route (dest)) {
+      return failed_request<void> (sys_error (cix_errc::invalid,
+                                   source + " -> " + dest, EXDEV));
+   }
+   return with_connection<void> (route (source),
+          [source, dest] (cix_connection& conn) {
+             return conn.copy (source, dest);
+          });
+}
+
+cix_task<cix_result<void>> cix_pool::move (string source, string dest) {
+   if (route (source) != route (dest)) {
+      return failed_request<void> (sys_error (cix_errc::invalid,
+                                   source + " -> " + dest, EXDEV));
+   }
+   return with_connection<void> (route (source),
+          [source, dest] (cix_connection& conn) {
+             return conn.move (source, dest);
+          });
+}
+
+cix_task<cix_result<string>> cix_pool::ls (string node) {
+   return with_connection<string> (node,
+          [] (cix_connection& conn) { return conn.ls(); });
+}
+
+cix_task<cix_result<string>> cix_pool::stats (string node) {
+   return with_connection<string> (node,
+          [] (cix_connection& conn) { return conn.stats(); });
+}
+
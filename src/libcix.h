@@ -0,0 +1,365 @@
+// $Id$
+
+//
+// libcix
+// embeddable asynchronous cix client.  Every request is a C++20
+// coroutine returning a cix_task, run by a single threaded epoll
+// cix_event_loop.  A cix_connection carries one request at a time;
+// cix_pool keeps connections to each daemon of a cluster, routes
+// paths over a cix_ring, and runs as many requests at once as it
+// has connections.  Failures come back as cix_error values:
+// nothing is logged and nothing is thrown for a failed request.
+//
+
+#ifndef __LIBCIX_H__
+#define __LIBCIX_H__
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+using namespace std;
+
+#include "cixlib.h"
+#include "cixring.h"
+
+//
+// cix_error, cix_result
+// what went wrong, or the value of a request that worked.
+// remote means the daemon refused the request and the connection
+// is still usable; after any other error it is not.
+//
+
+enum class cix_errc {invalid, connect, io, closed, protocol, remote};
+
+struct cix_error {
+   cix_errc code;
+   int sys_errno {0};
+   string message;
+};
+
+template <typename T>
+class cix_result {
+   private:
+      variant<T,cix_error> outcome;
+   public:
+      cix_result (T value): outcome (std::move (value)) {}
+      cix_result (cix_error error): outcome (std::move (error)) {}
+      bool ok() const { return outcome.index() == 0; }
+      explicit operator bool() const { return ok(); }
+      T& operator*() { return std::get<0> (outcome); }
+      T* operator->() { return &std::get<0> (outcome); }
+      const cix_error& error() const { return std::get<1> (outcome); }
+};
+
+template <>
+class cix_result<void> {
+   private:
+      optional<cix_error> failure;
+   public:
+      cix_result() {}
+      cix_result (cix_error error): failure (std::move (error)) {}
+      bool ok() const { return not failure; }
+      explicit operator bool() const { return ok(); }
+      const cix_error& error() const { return *failure; }
+};
+
+//
+// class cix_task
+// a lazily started coroutine.  Awaiting it starts it and resumes
+// the awaiting coroutine when it finishes.
+//
+
+template <typename T>
+struct cix_promise_value {
+   optional<T> value;
+   void return_value (T result) { value.emplace (std::move (result)); }
+   T take() { return std::move (*value); }
+};
+
+template <>
+struct cix_promise_value<void> {
+   void return_void() {}
+   void take() {}
+};
+
+template <typename T>
+class cix_task {
+   public:
+      struct promise_type: cix_promise_value<T> {
+         coroutine_handle<> continuation;
+         exception_ptr exception;
+         cix_task get_return_object() {
+            return cix_task (handle_type::from_promise (*this));
+         }
+         suspend_always initial_suspend() noexcept { return {}; }
+         struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            coroutine_handle<> await_suspend (
+                     coroutine_handle<promise_type> handle) noexcept {
+               coroutine_handle<> next = handle.promise().continuation;
+               return next ? next : noop_coroutine();
+            }
+            void await_resume() noexcept {}
+         };
+         final_awaiter final_suspend() noexcept { return {}; }
+         void unhandled_exception() { exception = current_exception(); }
+      };
+      using handle_type = coroutine_handle<promise_type>;
+   private:
+      handle_type handle;
+      explicit cix_task (handle_type handle): handle (handle) {}
+   public:
+      cix_task (cix_task&& that): handle (that.handle) {
+         that.handle = nullptr;
+      }
+      cix_task (const cix_task&) = delete;
+      cix_task& operator= (const cix_task&) = delete;
+      ~cix_task() { if (handle) handle.destroy(); }
+      bool done() const { return handle.done(); }
+      void start() { handle.resume(); }
+      T result() {
+         if (handle.promise().exception) {
+            rethrow_exception (handle.promise().exception);
+         }
+         return handle.promise().take();
+      }
+      bool await_ready() const { return false; }
+      coroutine_handle<> await_suspend (coroutine_handle<> caller) {
+         handle.promise().continuation = caller;
+         return handle;
+      }
+      T await_resume() { return result(); }
+};
+
+//
+// class cix_event_loop
+// resumes coroutines waiting for a socket to become readable or
+// writable, for a time to come, and those posted to it.  Not
+// thread safe:  one loop per thread.
+//
+
+class cix_event_loop {
+   private:
+      struct io_waiters {
+         coroutine_handle<> reader;
+         coroutine_handle<> writer;
+         bool registered {false};
+      };
+      int epoll_fd;
+      unordered_map<int,io_waiters> waiters;
+      multimap<chrono::steady_clock::time_point,coroutine_handle<>> timers;
+      deque<coroutine_handle<>> ready;
+      list<cix_task<void>> spawned;
+      void update (int fd, io_waiters& entry);
+      int expire_timers();
+      void run_once();
+      cix_event_loop (const cix_event_loop&) = delete;
+      cix_event_loop& operator= (const cix_event_loop&) = delete;
+   public:
+      cix_event_loop();
+      ~cix_event_loop();
+      struct io_awaiter {
+         cix_event_loop& loop;
+         int fd;
+         bool write;
+         bool await_ready() const { return false; }
+         void await_suspend (coroutine_handle<> handle) {
+            loop.wait_io (fd, write, handle);
+         }
+         void await_resume() const {}
+      };
+      io_awaiter readable (int fd) { return {*this, fd, false}; }
+      io_awaiter writable (int fd) { return {*this, fd, true}; }
+      struct timer_awaiter {
+         cix_event_loop& loop;
+         chrono::steady_clock::time_point when;
+         bool await_ready() const {
+            return chrono::steady_clock::now() >= when;
+         }
+         void await_suspend (coroutine_handle<> handle) {
+            loop.timers.emplace (when, handle);
+         }
+         void await_resume() const {}
+      };
+      timer_awaiter sleep_until (chrono::steady_clock::time_point when) {
+         return {*this, when};
+      }
+      void wait_io (int fd, bool write, coroutine_handle<> handle);
+      // Must be called before fd is closed.
+      void forget (int fd);
+      void post (coroutine_handle<> handle) { ready.push_back (handle); }
+      // Start a task now and keep it until it finishes.
+      void spawn (cix_task<void> task);
+      // Run until every spawned task has finished.
+      void run();
+      template <typename T>
+      T run (cix_task<T> task) {
+         task.start();
+         while (not task.done()) run_once();
+         return task.result();
+      }
+};
+
+// File contents are handed to a sink as they arrive, and taken
+// from a source, which returns how much it filled, as they go out.
+using cix_sink = function<void (const char* data, size_t nbytes)>;
+using cix_source = function<size_t (char* data, size_t nbytes)>;
+
+struct cix_file_info {
+   uint64_t size {0};
+   int64_t mtime {-1};         // -1 if the daemon did not say
+   bool not_modified {false};  // get_if:  the validator matched
+};
+
+// A request on many files:  how many worked, and the errno of each
+// one that did not.
+struct cix_batch_result {
+   size_t done {0};
+   vector<pair<string,int>> failed;
+};
+
+//
+// class cix_connection
+// one connection to a daemon, by "host:port" or unix socket path.
+// On a unix socket a GET is answered with the open file itself,
+// which is mapped and handed to the sink in one piece.
+//
+
+class cix_connection {
+   private:
+      cix_event_loop& loop;
+      int fd;
+      bool local;
+      cix_connection (cix_event_loop& loop, int fd, bool local):
+                      loop (loop), fd (fd), local (local) {}
+      cix_connection (const cix_connection&) = delete;
+      cix_connection& operator= (const cix_connection&) = delete;
+      cix_task<cix_result<void>> request (cix_header& header,
+                                          const void* payload = nullptr);
+      cix_task<cix_result<cix_file_info>> recv_file (
+                     cix_header& header, int64_t mtime, int file_fd,
+                     cix_sink& sink);
+      cix_task<cix_result<string>> recv_text (cix_command command);
+      cix_task<cix_result<void>> copy_request (cix_command command,
+                                               string source,
+                                               string dest);
+   public:
+      ~cix_connection();
+      using pointer = unique_ptr<cix_connection>;
+      static cix_task<cix_result<pointer>> open (cix_event_loop& loop,
+                                                 string node);
+      bool is_local() const { return local; }
+      // fd, if not null, gets a descriptor passed with the data,
+      // or -1.
+      cix_task<cix_result<void>> send (const void* buffer, size_t size);
+      cix_task<cix_result<void>> recv (void* buffer, size_t size,
+                                       int* fd = nullptr);
+      cix_task<cix_result<cix_file_info>> get (string filename,
+                                               cix_sink sink);
+      // Conditional GET:  nothing reaches the sink if the daemon's
+      // copy still matches the validator.
+      cix_task<cix_result<cix_file_info>> get_if (
+                     string filename, cix_validator validator,
+                     cix_sink sink);
+      // Returns the number of copies stored.  A source that fills
+      // less than size ends the connection and nothing is stored.
+      cix_task<cix_result<uint32_t>> put (string filename, uint64_t size,
+                                          cix_source source);
+      cix_task<cix_result<void>> rm (string filename);
+      // Remove paths or wildcards in one round trip.
+      cix_task<cix_result<cix_batch_result>> rm (vector<string> patterns);
+      // Copy or rename on the daemon; no file data travels.
+      cix_task<cix_result<void>> copy (string source, string dest);
+      cix_task<cix_result<void>> move (string source, string dest);
+      cix_task<cix_result<string>> ls();
+      cix_task<cix_result<string>> stats();
+      // Changes to files under prefix after seq since, or from now
+      // on if since is 0, until handler returns false.  Save the
+      // largest seq seen to resume from after reconnecting.  The
+      // connection can not be used for anything else afterwards.
+      cix_task<cix_result<void>> watch (
+                     string prefix, uint64_t since,
+                     function<bool (const cix_event&)> handler);
+};
+
+//
+// class cix_pool
+// connections to the daemons of a cluster, at most max_connections
+// to each.  Requests beyond that wait for a connection to be
+// released.  Connections that failed are dropped, not reused.
+//
+
+class cix_pool {
+   private:
+      struct node_slot {
+         vector<cix_connection::pointer> idle;
+         size_t open {0};
+         deque<coroutine_handle<>> waiting;
+      };
+      struct slot_awaiter {
+         deque<coroutine_handle<>>& waiting;
+         bool await_ready() const { return false; }
+         void await_suspend (coroutine_handle<> handle) {
+            waiting.push_back (handle);
+         }
+         void await_resume() const {}
+      };
+      cix_event_loop& loop;
+      size_t max_connections;
+      cix_ring ring;
+      map<string,node_slot> slots;
+      cix_task<cix_result<cix_connection::pointer>> acquire (string node);
+      void release (const string& node, cix_connection::pointer conn,
+                    bool reuse);
+      template <typename T, typename Request>
+      cix_task<cix_result<T>> with_connection (string node,
+                                               Request request) {
+         auto conn = co_await acquire (node);
+         if (not conn) co_return conn.error();
+         cix_result<T> result = co_await request (**conn);
+         release (node, std::move (*conn), result.ok()
+                  or result.error().code == cix_errc::remote);
+         co_return result;
+      }
+   public:
+      static constexpr size_t DEFAULT_MAX_CONNECTIONS = 8;
+      cix_pool (cix_event_loop& loop, const vector<string>& nodes,
+                size_t max_connections = DEFAULT_MAX_CONNECTIONS);
+      void add (const string& node);
+      void remove (const string& node);
+      const string& route (const string& path) const {
+         return ring.lookup (cix_route_name (path));
+      }
+      const vector<string>& nodes() const { return ring.nodes(); }
+      const cix_ring& get_ring() const { return ring; }
+      // Requests for a path go to the daemon that owns it.
+      cix_task<cix_result<cix_file_info>> get (string filename,
+                                               cix_sink sink);
+      cix_task<cix_result<cix_file_info>> get_if (
+                     string filename, cix_validator validator,
+                     cix_sink sink);
+      cix_task<cix_result<uint32_t>> put (string filename, uint64_t size,
+                                          cix_source source);
+      cix_task<cix_result<void>> rm (string filename);
+      // Plain paths go to their owner, wildcards to every daemon.
+      cix_task<cix_result<cix_batch_result>> rm (vector<string> patterns);
+      // Both paths must belong to the same daemon, else EXDEV.
+      cix_task<cix_result<void>> copy (string source, string dest);
+      cix_task<cix_result<void>> move (string source, string dest);
+      // Requests for a daemon.
+      cix_task<cix_result<string>> ls (string node);
+      cix_task<cix_result<string>> stats (string node);
+};
+
+#endif
+
@@ -3,12 +3,15 @@
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 using namespace std;
 
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 #include "sockets.h"
 
@@ -26,24 +29,114 @@ void base_socket::close() {
    socket_fd = CLOSED_FD;
 }
 
-void base_socket::create() {
+void base_socket::create (int domain) {
 //w or w/o :: doesn't matter
-   socket_fd = ::socket (AF_INET, SOCK_STREAM, 0); 
+   socket_fd = ::socket (domain, SOCK_STREAM, 0); 
    if (socket_fd < 0) throw socket_sys_error ("socket");
+   socket_family = domain;
+   if (domain == AF_UNIX) return;
    int on = 1;
    int status = ::setsockopt (socket_fd, SOL_SOCKET, SO_REUSEADDR,
                             &on, sizeof on);
    if (status < 0) throw socket_sys_error ("setsockopt");
 }
 
-void base_socket::bind (const in_port_t port) {
-   socket_addr.sin_family = AF_INET;
-   socket_addr.sin_addr.s_addr = INADDR_ANY;
-   socket_addr.sin_port = htons (port);
-   int status = ::bind (socket_fd, (sockaddr*) &socket_addr,
-                        sizeof socket_addr);
-   if (status < 0) throw socket_sys_error ("bind(" + to_string (port)
-                                           + ")");
+using addrinfo_ptr = unique_ptr<addrinfo, decltype (&freeaddrinfo)>;
+
+addrinfo_ptr get_addrinfo (const string& host, const in_port_t port,
+                           int flags) {
+   addrinfo hints;
+   memset (&hints, 0, sizeof hints);
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = flags;
+   addrinfo* result = nullptr;
+   int rc = ::getaddrinfo (host.size() == 0 ? nullptr : host.c_str(),
+                           to_string (port).c_str(), &hints, &result);
+   if (rc != 0) throw socket_gai_error ("getaddrinfo(" + host + ")", rc);
+   return addrinfo_ptr (result, freeaddrinfo);
+}
+
+// Order addresses for connecting:  alternate between families,
+// starting with IPv6 (RFC 8305 section 4).
+vector<const addrinfo*> interleave_families (const addrinfo* list) {
+   vector<const addrinfo*> inet6;
+   vector<const addrinfo*> other;
+   for (const addrinfo* addr = list; addr != nullptr;
+        addr = addr->ai_next) {
+      if (addr->ai_family == AF_INET6) inet6.push_back (addr);
+                                  else other.push_back (addr);
+   }
+   vector<const addrinfo*> ordered;
+   for (size_t index = 0; index < inet6.size() or index < other.size();
+        ++index) {
+      if (index < inet6.size()) ordered.push_back (inet6[index]);
+      if (index < other.size()) ordered.push_back (other[index]);
+   }
+   return ordered;
+}
+
+// An empty host binds the wildcard address.  Prefer an IPv6 socket
+// with IPV6_V6ONLY off so that IPv4 clients are served as well,
+// and fall back to IPv4 if the kernel has no IPv6.
+void base_socket::bind (const string& host, const in_port_t port) {
+   addrinfo_ptr list = get_addrinfo (host, port, AI_PASSIVE);
+   string where = "bind(" + host + ":" + to_string (port) + ")";
+   int saved_errno = EADDRNOTAVAIL;
+   for (const addrinfo* addr: interleave_families (list.get())) {
+      socket_fd = ::socket (addr->ai_family, SOCK_STREAM, 0);
+      if (socket_fd < 0) {
+         saved_errno = errno;
+         continue;
+      }
+      socket_family = addr->ai_family;
+      int on = 1;
+      int status = ::setsockopt (socket_fd, SOL_SOCKET, SO_REUSEADDR,
+                                 &on, sizeof on);
+      if (status < 0) throw socket_sys_error ("setsockopt");
+      if (addr->ai_family == AF_INET6) {
+         int v6only = host.size() == 0 ? 0 : 1;
+         status = ::setsockopt (socket_fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                                &v6only, sizeof v6only);
+         if (status < 0) throw socket_sys_error ("setsockopt");
+      }
+      status = ::bind (socket_fd, addr->ai_addr, addr->ai_addrlen);
+      if (status == 0) {
+         memcpy (&socket_addr, addr->ai_addr, addr->ai_addrlen);
+         socket_addrlen = addr->ai_addrlen;
+         return;
+      }
+      saved_errno = errno;
+      ::close (socket_fd);
+      socket_fd = CLOSED_FD;
+   }
+   errno = saved_errno;
+   throw socket_sys_error (where);
+}
+
+void base_socket::bind (const string& path) {
+   create (AF_UNIX);
+   sockaddr_un addr;
+   memset (&addr, 0, sizeof addr);
+   if (path.size() >= sizeof addr.sun_path)
+      throw socket_error ("bind(" + path + "): path too long");
+   addr.sun_family = AF_UNIX;
+   strcpy (addr.sun_path, path.c_str());
+   // A stale socket from a previous daemon is removed; anything
+   // else at the path is not ours to delete.
+   struct stat stat_buf;
+   if (::lstat (path.c_str(), &stat_buf) == 0) {
+      if (not S_ISSOCK (stat_buf.st_mode)) {
+         errno = EEXIST;
+         throw socket_sys_error ("bind(" + path + ")");
+      }
+      ::unlink (path.c_str());
+   }
+   int status = ::bind (socket_fd, (sockaddr*) &addr, sizeof addr);
+   if (status < 0) throw socket_sys_error ("bind(" + path + ")");
+   memcpy (&socket_addr, &addr, sizeof addr);
+   socket_addrlen = sizeof addr;
+   socket_path = path;
 }
 
 void base_socket::listen() const {
@@ -53,16 +146,19 @@ void base_socket::listen() const {
 
 
 void base_socket::accept (base_socket& new_socket) const {
-   int addr_length = sizeof new_socket.socket_addr;
+   new_socket.socket_addrlen = sizeof new_socket.socket_addr;
    new_socket.socket_fd = ::accept (socket_fd,
                             (sockaddr*) &new_socket.socket_addr,
-                            (socklen_t*) &addr_length);
+                            &new_socket.socket_addrlen);
    if (new_socket.socket_fd < 0) throw socket_sys_error ("accept");
+   new_socket.socket_family = socket_family;
+   new_socket.socket_path = socket_path;
 }
 
 ssize_t base_socket::send (const void* buffer, size_t bufsize) {
    int nbytes = ::send (socket_fd, buffer, bufsize, MSG_NOSIGNAL);
    if (nbytes < 0) throw socket_sys_error ("send");
+   bytes_sent += nbytes;
    return nbytes;
 }
 
@@ -70,29 +166,164 @@ ssize_t base_socket::recv (void* buffer, size_t bufsize) {
    memset (buffer, 0, bufsize);
    ssize_t nbytes = ::recv (socket_fd, buffer, bufsize, 0);
    if (nbytes < 0) throw socket_sys_error ("recv");
+   bytes_received += nbytes;
+   return nbytes;
+}
+
+ssize_t base_socket::send_fd (int fd, const void* buffer,
+                              size_t bufsize) {
+   iovec iov;
+   iov.iov_base = const_cast<void*> (buffer);
+   iov.iov_len = bufsize;
+   char control[CMSG_SPACE (sizeof fd)];
+   memset (control, 0, sizeof control);
+   msghdr msg;
+   memset (&msg, 0, sizeof msg);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof control;
+   cmsghdr* cmsg = CMSG_FIRSTHDR (&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN (sizeof fd);
+   memcpy (CMSG_DATA (cmsg), &fd, sizeof fd);
+   ssize_t nbytes = ::sendmsg (socket_fd, &msg, MSG_NOSIGNAL);
+   if (nbytes < 0) throw socket_sys_error ("sendmsg");
+   bytes_sent += nbytes;
+   return nbytes;
+}
+
+// fd is set to -1 if the peer did not pass a descriptor
+ssize_t base_socket::recv_fd (int& fd, void* buffer, size_t bufsize) {
+   memset (buffer, 0, bufsize);
+   iovec iov;
+   iov.iov_base = buffer;
+   iov.iov_len = bufsize;
+   char control[CMSG_SPACE (sizeof fd)];
+   msghdr msg;
+   memset (&msg, 0, sizeof msg);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof control;
+   ssize_t nbytes = ::recvmsg (socket_fd, &msg, MSG_CMSG_CLOEXEC);
+   if (nbytes < 0) throw socket_sys_error ("recvmsg");
+   bytes_received += nbytes;
+   fd = -1;
+   cmsghdr* cmsg = CMSG_FIRSTHDR (&msg);
+   if (cmsg != nullptr and cmsg->cmsg_level == SOL_SOCKET
+                      and cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy (&fd, CMSG_DATA (cmsg), sizeof fd);
+   }
    return nbytes;
 }
 
+// Happy eyeballs:  start a connection to each address in turn,
+// CONNECT_ATTEMPT_DELAY_MS apart, without waiting for the earlier
+// ones to fail.  The first to complete wins and the rest are closed.
 void base_socket::connect (const string host, const in_port_t port) {
-   struct hostent *hostp = ::gethostbyname (host.c_str());
-   if (hostp == NULL) throw socket_h_error ("gethostbyname("
-                            + host + ")");
-   socket_addr.sin_family = AF_INET;
-   socket_addr.sin_port = htons (port);
-   socket_addr.sin_addr = *(in_addr*) hostp->h_addr;
-   int status = ::connect (socket_fd, (sockaddr*) &socket_addr,
-                           sizeof (socket_addr));
-   if (status < 0) throw socket_sys_error ("connect(" + host + ":"
-                         + to_string (port) + ")");
+   addrinfo_ptr list = get_addrinfo (host, port, 0);
+   vector<const addrinfo*> candidates = interleave_families (list.get());
+   vector<pollfd> pending;
+   vector<const addrinfo*> pending_addr;
+   const addrinfo* winner = nullptr;
+   int saved_errno = ECONNREFUSED;
+   size_t next = 0;
+   while (winner == nullptr
+          and (next < candidates.size() or pending.size() > 0)) {
+      if (next < candidates.size()) {
+         const addrinfo* addr = candidates[next++];
+         int fd = ::socket (addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK,
+                            0);
+         if (fd < 0) {
+            saved_errno = errno;
+            continue;
+         }
+         int status = ::connect (fd, addr->ai_addr, addr->ai_addrlen);
+         if (status == 0) {
+            socket_fd = fd;
+            winner = addr;
+            break;
+         }
+         if (errno != EINPROGRESS) {
+            saved_errno = errno;
+            ::close (fd);
+            continue;
+         }
+         pending.push_back ({fd, POLLOUT, 0});
+         pending_addr.push_back (addr);
+      }
+      int timeout = next < candidates.size()
+                  ? CONNECT_ATTEMPT_DELAY_MS : -1;
+      int ready = ::poll (pending.data(), pending.size(), timeout);
+      if (ready < 0 and errno != EINTR) throw socket_sys_error ("poll");
+      for (size_t index = 0; ready > 0 and index < pending.size(); ) {
+         if (pending[index].revents == 0) {
+            ++index;
+            continue;
+         }
+         int error = 0;
+         socklen_t errlen = sizeof error;
+         ::getsockopt (pending[index].fd, SOL_SOCKET, SO_ERROR,
+                       &error, &errlen);
+         if (error == 0) {
+            socket_fd = pending[index].fd;
+            winner = pending_addr[index];
+         }else {
+            saved_errno = error;
+            ::close (pending[index].fd);
+         }
+         pending.erase (pending.begin() + index);
+         pending_addr.erase (pending_addr.begin() + index);
+         if (winner != nullptr) break;
+      }
+   }
+   for (const auto& loser: pending) ::close (loser.fd);
+   if (winner == nullptr) {
+      errno = saved_errno;
+      throw socket_sys_error ("connect(" + host + ":"
+                              + to_string (port) + ")");
+   }
+   socket_family = winner->ai_family;
+   memcpy (&socket_addr, winner->ai_addr, winner->ai_addrlen);
+   socket_addrlen = winner->ai_addrlen;
+   set_non_blocking (false);
+}
+
+void base_socket::connect (const string& path) {
+   create (AF_UNIX);
+   sockaddr_un addr;
+   memset (&addr, 0, sizeof addr);
+   if (path.size() >= sizeof addr.sun_path)
+      throw socket_error ("connect(" + path + "): path too long");
+   addr.sun_family = AF_UNIX;
+   strcpy (addr.sun_path, path.c_str());
+   int status = ::connect (socket_fd, (sockaddr*) &addr, sizeof addr);
+   if (status < 0) throw socket_sys_error ("connect(" + path + ")");
+   memcpy (&socket_addr, &addr, sizeof addr);
+   socket_addrlen = sizeof addr;
+   socket_path = path;
 }
 
 void base_socket::set_socket_fd (int fd) {
    socket_fd = fd;
-   socklen_t addrlen = sizeof socket_addr;
-   int rc = getpeername (socket_fd, (sockaddr*) &socket_addr, &addrlen);
+   sockaddr_storage local_addr;
+   memset (&local_addr, 0, sizeof local_addr);
+   socklen_t addrlen = sizeof local_addr;
+   int rc = getsockname (socket_fd, (sockaddr*) &local_addr, &addrlen);
+   if (rc < 0) throw socket_sys_error ("getsockname");
+   socket_family = local_addr.ss_family;
+   if (socket_family == AF_UNIX) {
+      socket_path = ((sockaddr_un*) &local_addr)->sun_path;
+      return;
+   }
+   if (socket_family != AF_INET and socket_family != AF_INET6)
+      throw socket_error ("address not AF_INET, AF_INET6 or AF_UNIX");
+   socket_addrlen = sizeof socket_addr;
+   rc = getpeername (socket_fd, (sockaddr*) &socket_addr,
+                     &socket_addrlen);
    if (rc < 0) throw socket_sys_error ("getpeername");
-   if (socket_addr.sin_family != AF_INET)
-      throw socket_error ("address not AF_INET");
 }
 
 void base_socket::set_non_blocking (const bool blocking) {
@@ -106,13 +337,25 @@ void base_socket::set_non_blocking (const bool blocking) {
 
 
 client_socket::client_socket (string host, in_port_t port) {
-   base_socket::create();
    base_socket::connect (host, port);
 }
 
+client_socket::client_socket (string path) {
+   base_socket::connect (path);
+}
+
 server_socket::server_socket (in_port_t port) {
-   base_socket::create();
-   base_socket::bind (port);
+   base_socket::bind ("", port);
+   base_socket::listen();
+}
+
+server_socket::server_socket (const string& host, in_port_t port) {
+   base_socket::bind (host, port);
+   base_socket::listen();
+}
+
+server_socket::server_socket (const string& path) {
+   base_socket::bind (path);
    base_socket::listen();
 }
 
@@ -132,9 +375,20 @@ string to_string (const in_addr& ipv4_addr) {
 
 // private to_string for base_socket
 string to_string (const base_socket& sock) {
-   hostinfo info (sock.socket_addr.sin_addr);
-   return info.hostname + " (" + to_string (info.addresses[0])
-          + ") port " + to_string (ntohs (sock.socket_addr.sin_port));
+   if (sock.is_local()) return "local socket " + sock.socket_path;
+   char hostname[NI_MAXHOST];
+   char address[NI_MAXHOST];
+   char port[NI_MAXSERV];
+   const sockaddr* addr = (const sockaddr*) &sock.socket_addr;
+   int rc = ::getnameinfo (addr, sock.socket_addrlen, address,
+                           sizeof address, port, sizeof port,
+                           NI_NUMERICHOST | NI_NUMERICSERV);
+   if (rc != 0) throw socket_gai_error ("getnameinfo", rc);
+   // No reverse name is not an error:  just show the address twice.
+   rc = ::getnameinfo (addr, sock.socket_addrlen, hostname,
+                       sizeof hostname, nullptr, 0, 0);
+   if (rc != 0) strcpy (hostname, address);
+   return string (hostname) + " (" + address + ") port " + port;
 }
 
 
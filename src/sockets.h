@@ -3,6 +3,7 @@
 #ifndef __SOCKET_H__
 #define __SOCKET_H__
 
+#include <cstdint>
 #include <cstring>
 #include <stdexcept>
 #include <string>
@@ -15,6 +16,7 @@ using namespace std;
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -27,20 +29,29 @@ class base_socket {
    private:
       static constexpr size_t MAXRECV = 0xFFFF;
       static constexpr int CLOSED_FD = -1;
+      // delay before racing the next address (RFC 8305 happy eyeballs)
+      static constexpr int CONNECT_ATTEMPT_DELAY_MS = 250;
       int socket_fd {CLOSED_FD};
-      sockaddr_in socket_addr;
+      int socket_family {AF_INET};
+      sockaddr_storage socket_addr;
+      socklen_t socket_addrlen {0};
+      string socket_path; // AF_UNIX only
+      uint64_t bytes_sent {0};
+      uint64_t bytes_received {0};
       base_socket (const base_socket&) = delete; // prevent copying
       base_socket& operator= (const base_socket&) = delete;
    protected:
       base_socket(); // only derived classes may construct
       ~base_socket();
       // server_socket initialization
-      void create();
-      void bind (const in_port_t port);
+      void create (int domain = AF_INET);
+      void bind (const string& host, const in_port_t port); // ""=any
+      void bind (const string& path); // AF_UNIX
       void listen() const;
       void accept (base_socket&) const;
       // client_socket initialization
       void connect (const string host, const in_port_t port);
+      void connect (const string& path); // AF_UNIX
       // accepted_socket initialization
       // where is to_string (socket_fd??)
       //string to_string_socket_fd()
@@ -51,6 +62,14 @@ class base_socket {
       void close();
       ssize_t send (const void* buffer, size_t bufsize);
       ssize_t recv (void* buffer, size_t bufsize);
+      // AF_UNIX only: pass an open fd along with the data (SCM_RIGHTS)
+      ssize_t send_fd (int fd, const void* buffer, size_t bufsize);
+      ssize_t recv_fd (int& fd, void* buffer, size_t bufsize);
+      bool is_local() const { return socket_family == AF_UNIX; }
+      int get_socket_fd() const { return socket_fd; }
+      // Totals since the socket was made, for tracing.
+      uint64_t get_bytes_sent() const { return bytes_sent; }
+      uint64_t get_bytes_received() const { return bytes_received; }
       void set_non_blocking (const bool); //off-on blocking
       friend string to_string (const base_socket& sock);
 };
@@ -77,7 +96,8 @@ class accepted_socket: public base_socket {
 
 class client_socket: public base_socket {
    public: 
-      client_socket (string host, in_port_t port);
+      client_socket (string host, in_port_t port); // IPv4 or IPv6
+      client_socket (string path); // unix domain socket on same host
 };
 
 //
@@ -87,7 +107,9 @@ class client_socket: public base_socket {
 
 class server_socket: public base_socket {
    public:
-      server_socket (in_port_t port);
+      server_socket (in_port_t port); // all addresses, dual-stack
+      server_socket (const string& host, in_port_t port);
+      server_socket (const string& path); // unix domain socket
       void accept (accepted_socket& sock) {
          base_socket::accept (sock);
       }
@@ -131,6 +153,20 @@ class socket_h_error: public socket_error {
 };
 
 
+//
+// class socket_gai_error
+// subclass to record the status returned by getaddrinfo
+//
+
+class socket_gai_error: public socket_error {
+   public:
+      int gai_errno;
+      explicit socket_gai_error (const string& what, int gai_errno):
+               socket_error(what + ": " + gai_strerror (gai_errno)),
+               gai_errno(gai_errno) {}
+};
+
+
 //
 // class hostinfo
 // information about a host given hostname or IPv4 address